@@ -0,0 +1,81 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+#include "BinaryIO.h"
+#include "real.h"
+
+
+/// What main outputs for -compute-backbone-dim, from the (euclidean, geodesic) distance pairs between the nodes of a tree
+enum class BackboneDimensionMode {
+	RAW, // every pair, as 2 real_t values each (O(N^2) output)
+	HISTOGRAM, // log-binned 2D histogram of the pairs, along with the fitted slope
+	SLOPE // only the fitted slope
+};
+
+
+/// Summary of (euclidean, geodesic) distance pairs along a tree's backbone, accumulated one pair at a time
+/// Keeps a 2D histogram with log-spaced bins along both axes, and the sums needed for a least squares fit of log(geodesic) against log(euclidean),
+/// whose slope is the backbone dimension d_m (geodesic distance ~ euclidean distance ^ d_m)
+struct BackboneDimensionHistogram {
+
+	static constexpr int BinsPerDecade = 20;
+	static constexpr int MinDecade = -6; // distances below 10^MinDecade go in the first bin
+	static constexpr int MaxDecade = 1; // distances above 10^MaxDecade go in the last bin
+	static constexpr int Bins = (MaxDecade - MinDecade) * BinsPerDecade;
+
+	std::vector<std::uint64_t> counts = std::vector<std::uint64_t>(Bins * Bins, 0); // counts[euclideanBin * Bins + geodesicBin]
+
+	// sums over all pairs (with non-zero distances) of x = log10(euclidean), y = log10(geodesic)
+	double n = 0, sumX = 0, sumY = 0, sumXX = 0, sumXY = 0;
+
+	static inline int bin(double log10Distance) {
+		return std::min(Bins - 1, std::max(0, int(std::floor((log10Distance - MinDecade) * BinsPerDecade))));
+	}
+
+	inline void add(real_t euclidean, real_t geodesic) {
+		if (euclidean <= 0 || geodesic <= 0) return;
+		double x = std::log10(double(euclidean)), y = std::log10(double(geodesic));
+		++counts[bin(x) * Bins + bin(y)];
+		n += 1;
+		sumX += x;
+		sumY += y;
+		sumXX += x * x;
+		sumXY += x * y;
+	}
+
+	inline void merge(const BackboneDimensionHistogram& other) {
+		for (int i = 0; i < Bins * Bins; ++i) counts[i] += other.counts[i];
+		n += other.n;
+		sumX += other.sumX;
+		sumY += other.sumY;
+		sumXX += other.sumXX;
+		sumXY += other.sumXY;
+	}
+
+	/// Backbone dimension estimate (slope of the log-log fit), or 0 without enough pairs to fit
+	inline double slope() const {
+		double denominator = n * sumXX - sumX * sumX;
+		return denominator == 0 ? 0 : (n * sumXY - sumX * sumY) / denominator;
+	}
+
+	inline double intercept() const {
+		return n == 0 ? 0 : (sumY - slope() * sumX) / n;
+	}
+
+	/// Writes the fit, then the bin layout and counts (euclidean-major)
+	template<typename Bytes>
+	void write(Bytes& data) const {
+		bio::writeSimple<double>(data, slope());
+		bio::writeSimple<double>(data, intercept());
+		bio::writeSimple<std::uint64_t>(data, std::uint64_t(n));
+		bio::writeSimple<std::int32_t>(data, MinDecade);
+		bio::writeSimple<std::int32_t>(data, BinsPerDecade);
+		bio::writeSimple<std::int32_t>(data, Bins);
+		for (std::uint64_t c : counts) bio::writeSimple<std::uint64_t>(data, c);
+	}
+
+};
@@ -11,3 +11,58 @@ std::string bio::readString(const std::vector<std::uint8_t>& data, std::size_t&
 	}
 	return s;
 }
+
+
+bio::AsyncFileWriter::AsyncFileWriter(FILE* file, std::size_t maxPending) :
+	file(file), maxPending(maxPending) {
+	thread = std::thread(&AsyncFileWriter::run, this);
+}
+
+bio::AsyncFileWriter::~AsyncFileWriter() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	changed.notify_all();
+	thread.join();
+}
+
+void bio::AsyncFileWriter::queue(std::vector<std::uint8_t>& buffer) {
+	if (buffer.empty()) return;
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		changed.wait(lock, [this]() { return pending.size() < maxPending; });
+		pending.push_back(std::move(buffer));
+		if (spare.empty()) {
+			buffer = std::vector<std::uint8_t>();
+		} else {
+			buffer = std::move(spare.back());
+			spare.pop_back();
+		}
+	}
+	changed.notify_all();
+}
+
+void bio::AsyncFileWriter::wait() {
+	std::unique_lock<std::mutex> lock(mutex);
+	changed.wait(lock, [this]() { return pending.empty() && !writing; });
+}
+
+void bio::AsyncFileWriter::run() {
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		changed.wait(lock, [this]() { return !pending.empty() || stopping; });
+		if (pending.empty()) break; // stopping, with nothing left to write
+		std::vector<std::uint8_t> buffer = std::move(pending.front());
+		pending.pop_front();
+		writing = true;
+		lock.unlock();
+		changed.notify_all(); // room for another frame
+		std::fwrite(buffer.data(), sizeof(std::uint8_t), buffer.size(), file);
+		buffer.clear();
+		lock.lock();
+		spare.push_back(std::move(buffer));
+		writing = false;
+		changed.notify_all();
+	}
+}
@@ -1,8 +1,18 @@
 #pragma once
 
 #include <vector>
+#include <array>
 #include <string>
 #include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <type_traits>
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 
 #include "Vec.h"
 
@@ -10,18 +20,66 @@
 /// Functionality to read/write from binary data
 /// bio::writeXxx functions take a Bytes element (can be a std::vector<std::uint8_t> or a BufferedBinaryFileOutput<>) and writes values into it
 /// bio::readXxx functions take a std::vector<std::uint8_t> and read values from it
+/// Values are written as their in-memory bytes, one after the other; contiguous arrays of them are written in one go (writeArray & co.), with the same bytes as writing each value in turn
 ///
 
 namespace bio {
 	
+	/// Background thread writing whole buffers to a file, in the order they were queued
+	/// At most maxPending buffers wait for the thread at any time (on top of the one it is writing); queueing more blocks until it catches up, so memory use stays bounded
+	/// Written buffers are kept aside and handed back by queue(), so that steady state runs without reallocating
+	class AsyncFileWriter {
+	private:
+		FILE* file;
+		std::size_t maxPending;
+		std::deque<std::vector<std::uint8_t>> pending;
+		std::vector<std::vector<std::uint8_t>> spare;
+		bool writing = false;
+		bool stopping = false;
+		std::mutex mutex;
+		std::condition_variable changed;
+		std::thread thread;
+
+		void run();
+
+	public:
+
+		AsyncFileWriter(FILE* file, std::size_t maxPending);
+
+		/// Writes out everything still queued, then stops the thread (the file stays open)
+		~AsyncFileWriter();
+
+		/// Queues the contents of buffer to be written, and replaces it with an empty buffer
+		void queue(std::vector<std::uint8_t>& buffer);
+
+		/// Blocks until everything queued so far has been written
+		void wait();
+
+	}; // AsyncFileWriter
+	
 	/// Helper binary output stream that writes its contents to file incrementally
 	/// Can be fed instead of a std::vector<std::uint8_t> to the bio::writeXxx functions
+	/// If made asynchronous, contents are staged in memory instead, and each endFrame() hands them over to a background thread for writing (see AsyncFileWriter)
 	template<int BatchSize=16384>
 	struct BufferedBinaryFileOutput {
 	private:
 		std::uint8_t data[BatchSize];
 		FILE* file;
 		std::size_t size = 0;
+		std::uint64_t emitted = 0; // bytes sent on from data so far
+		std::unique_ptr<AsyncFileWriter> writer; // only when asynchronous
+		std::vector<std::uint8_t> staged; // contents of the current frame that didn't fit in data, when asynchronous
+		
+		/// Sends bytes on to the file, or to the current frame if asynchronous
+		inline void emit(const void* bytes, std::size_t count) {
+			emitted += count;
+			if (writer) {
+				const std::uint8_t* first = static_cast<const std::uint8_t*>(bytes);
+				staged.insert(staged.end(), first, first + count);
+			} else {
+				std::fwrite(bytes, sizeof(std::uint8_t), count, file);
+			}
+		}
 		
 	public:
 		
@@ -38,6 +96,15 @@ namespace bio {
 			}
 		#endif
 		
+		/// Moves writing to a background thread, with up to maxPendingFrames finished frames waiting for it (0 keeps writing synchronous)
+		void setAsynchronous(std::size_t maxPendingFrames) {
+			flush();
+			writer.reset();
+			if (maxPendingFrames > 0) {
+				writer = std::make_unique<AsyncFileWriter>(file, maxPendingFrames);
+			}
+		}
+		
 		/// Adds the byte to the buffer and if necessary dumps out contents into the file
 		inline void push_back(const std::uint8_t elem) {
 			data[size] = elem;
@@ -47,15 +114,58 @@ namespace bio {
 			}
 		}
 		
-		/// Dumps out the current contents of data into the output file, and gets ready to add more data
+		/// Adds count bytes to the buffer, dumping out contents into the file as necessary
+		/// Blocks at least as large as the buffer bypass it, going straight to the file
+		inline void write(const void* bytes, std::size_t count) {
+			if (count < BatchSize - size) {
+				std::memcpy(data + size, bytes, count);
+				size += count;
+				return;
+			}
+			dump();
+			if (count >= BatchSize) {
+				emit(bytes, count);
+			} else {
+				std::memcpy(data, bytes, count);
+				size = count;
+			}
+		}
+		
+		/// Number of bytes written so far, i.e. the offset in the file that the next byte will be written at
+		inline std::uint64_t offset() const { return emitted + size; }
+		
+		/// Dumps out the current contents of data into the output file (or the current frame if asynchronous), and gets ready to add more data
 		inline void dump() {
 			if (size <= 0) return;
-			std::fwrite(data, sizeof(std::uint8_t), size, file);
+			emit(data, size);
 			size = 0;
 		}
 		
+		/// Marks the end of a frame (e.g. a snapshot): if asynchronous, everything written since the last one gets queued for the background thread
+		/// Blocks if too many frames are already waiting to be written
+		inline void endFrame() {
+			if (!writer) return;
+			dump();
+			writer->queue(staged);
+		}
+		
+		/// Writes out everything written so far, waiting for the background thread if asynchronous
+		inline void flush() {
+			if (writer) {
+				endFrame();
+				writer->wait();
+			} else {
+				dump();
+			}
+			std::fflush(file);
+		}
+		
 		/// Dumps out remaining contents to the file and cleans up
 		~BufferedBinaryFileOutput() {
+			if (writer) {
+				endFrame();
+				writer.reset();
+			}
 			dump();
 			std::fclose(file);
 		}
@@ -63,17 +173,54 @@ namespace bio {
 	}; // BufferedBinaryFileOutput
 	
 
+	/// Writes count raw bytes to data
+	template<int BatchSize>
+	inline void writeBytes(BufferedBinaryFileOutput<BatchSize>& data, const void* bytes, std::size_t count) {
+		data.write(bytes, count);
+	}
+	inline void writeBytes(std::vector<std::uint8_t>& data, const void* bytes, std::size_t count) {
+		const std::uint8_t* first = static_cast<const std::uint8_t*>(bytes);
+		data.insert(data.end(), first, first + count);
+	}
+	/// Fallback for any other Bytes, one byte at a time
+	template<typename Bytes>
+	inline void writeBytes(Bytes& data, const void* bytes, std::size_t count) {
+		const std::uint8_t* first = static_cast<const std::uint8_t*>(bytes);
+		for (std::size_t i = 0; i < count; ++i) {
+			data.push_back(first[i]);
+		}
+	}
+
+	/// Number of bytes written to data so far
+	template<int BatchSize>
+	inline std::uint64_t bytesWritten(const BufferedBinaryFileOutput<BatchSize>& data) {
+		return data.offset();
+	}
+	inline std::uint64_t bytesWritten(const std::vector<std::uint8_t>& data) {
+		return data.size();
+	}
+
+	/// Writes zero bytes until the number of bytes written to data is a multiple of alignment (up to 16)
+	template<typename Bytes=BufferedBinaryFileOutput<>>
+	void writePadding(Bytes& data, std::size_t alignment) {
+		static const std::uint8_t zeros[16] = {};
+		assert(alignment <= sizeof(zeros));
+		std::size_t misalignment = std::size_t(bytesWritten(data) % alignment);
+		if (misalignment > 0) writeBytes(data, zeros, alignment - misalignment);
+	}
+
 	/// Writes a value of trivial type T (no pointers) to data as bytes
 	template<typename T, typename Bytes=BufferedBinaryFileOutput<>>
 	void writeSimple(Bytes& data, const T& val) {
-		union {
-			T original;
-			std::uint8_t bytes[sizeof(T)];
-		} o2b = {};
-		o2b.original = val;
-		for (std::size_t i = 0; i < sizeof(T); ++i) {
-			data.push_back(o2b.bytes[i]);
-		}
+		static_assert(std::is_trivially_copyable<T>::value, "writeSimple needs a trivially copyable type");
+		writeBytes(data, &val, sizeof(T));
+	}
+
+	/// Writes count contiguous values of trivial type T (no pointers) to data, as writeSimple would one at a time
+	template<typename T, typename Bytes=BufferedBinaryFileOutput<>>
+	void writeArray(Bytes& data, const T* values, std::size_t count) {
+		static_assert(std::is_trivially_copyable<T>::value, "writeArray needs a trivially copyable type");
+		writeBytes(data, values, count * sizeof(T));
 	}
 
 	/// Reads a value of trivial type T (no pointers) from data as bytes
@@ -93,21 +240,86 @@ namespace bio {
 	
 	template<typename Bytes=BufferedBinaryFileOutput<>>
 	void writeString(Bytes& data, const std::string& val) {
-		for (const char& c : val) {
-			writeSimple<char>(data, c);
-		}
-		writeSimple<char>(data, '\0');
+		writeArray<char>(data, val.c_str(), val.size() + 1); // along with the terminating '\0'
 	}
 
 	std::string readString(const std::vector<std::uint8_t>& data, std::size_t& at);
 
 	template<typename T, int N, typename Bytes=BufferedBinaryFileOutput<>>
 	void writeVec (Bytes& data, const Vec<T, N>& val) {
-		for (int i = 0; i < N; ++i) {
-			writeSimple<T>(data, val[i]);
+		writeArray<T>(data, val.data(), N);
+	}
+
+	/// Writes count vectors one after the other, as writeVec would one at a time
+	template<typename T, int N, typename Bytes=BufferedBinaryFileOutput<>>
+	void writeVecs (Bytes& data, const Vec<T, N>* vals, std::size_t count) {
+		static_assert(sizeof(Vec<T, N>) == N * sizeof(T), "vectors are expected to hold nothing but their components");
+		writeArray<T>(data, vals->data(), count * N);
+	}
+
+	/// Writes count vectors given as structure-of-arrays (components[axis][i]) one after the other, as writeVec would one at a time
+	/// Components get interleaved in chunks, so that they are still written in blocks
+	template<typename T, std::size_t N, typename Bytes=BufferedBinaryFileOutput<>>
+	void writeVecs (Bytes& data, const std::array<std::vector<T>, N>& components, std::size_t count) {
+		constexpr std::size_t ChunkSize = 1024;
+		T chunk[ChunkSize * N];
+		for (std::size_t first = 0; first < count; first += ChunkSize) {
+			std::size_t size = std::min(ChunkSize, count - first);
+			for (std::size_t i = 0; i < size; ++i) {
+				for (std::size_t a = 0; a < N; ++a) chunk[i * N + a] = components[a][first + i];
+			}
+			writeArray<T>(data, chunk, size * N);
 		}
 	}
 
+	///
+	/// SEL v6 frames store their particle data as columns: each column is a 16 byte header - 4 character name, element type, components per element, 2 bytes of padding, element count (u64) -
+	/// followed by count * components values; headers start at multiples of ColumnAlignment bytes into the file, so that the values of a memory mapped file can be used in place
+	///
+	
+	enum class ColumnType : std::uint8_t { FLOAT32 = 0, FLOAT64 = 1, INT32 = 2, UINT32 = 3, UINT8 = 4 };
+	
+	template<typename T> struct ColumnTypeOf;
+	template<> struct ColumnTypeOf<float> { static constexpr ColumnType value = ColumnType::FLOAT32; };
+	template<> struct ColumnTypeOf<double> { static constexpr ColumnType value = ColumnType::FLOAT64; };
+	template<> struct ColumnTypeOf<std::int32_t> { static constexpr ColumnType value = ColumnType::INT32; };
+	template<> struct ColumnTypeOf<std::uint32_t> { static constexpr ColumnType value = ColumnType::UINT32; };
+	template<> struct ColumnTypeOf<std::uint8_t> { static constexpr ColumnType value = ColumnType::UINT8; };
+	
+	constexpr std::size_t ColumnAlignment = 8;
+	
+	/// Writes the header of a column of count elements of components values of type T each; the values themselves are to be written right after
+	template<typename T, typename Bytes=BufferedBinaryFileOutput<>>
+	void writeColumnHeader(Bytes& data, const char (&name)[5], int components, std::uint64_t count) {
+		writePadding(data, ColumnAlignment);
+		writeArray<char>(data, name, 4);
+		writeSimple<std::uint8_t>(data, std::uint8_t(ColumnTypeOf<T>::value));
+		writeSimple<std::uint8_t>(data, std::uint8_t(components));
+		writeSimple<std::uint16_t>(data, 0);
+		writeSimple<std::uint64_t>(data, count);
+	}
+	
+	/// Writes a column of count elements, given as count * components contiguous values
+	template<typename T, typename Bytes=BufferedBinaryFileOutput<>>
+	void writeColumn(Bytes& data, const char (&name)[5], const T* values, int components, std::uint64_t count) {
+		writeColumnHeader<T>(data, name, components, count);
+		writeArray<T>(data, values, std::size_t(count) * components);
+	}
+	
+	/// Writes the index that ends SEL v6 files: the offset of each frame in the file (u64, 8 byte aligned),
+	/// then a 16 byte footer - frame count (u64), "SELI", version (u8), 3 bytes of padding
+	/// Readers can reach any frame from the end of the file; files without an index (e.g. from interrupted runs) can still be read frame by frame
+	template<typename Bytes=BufferedBinaryFileOutput<>>
+	void writeFrameIndex(Bytes& data, const std::vector<std::uint64_t>& frameOffsets, std::uint8_t version) {
+		static const std::uint8_t zeros[3] = {};
+		writePadding(data, 8);
+		writeArray<std::uint64_t>(data, frameOffsets.data(), frameOffsets.size());
+		writeSimple<std::uint64_t>(data, frameOffsets.size());
+		writeArray<char>(data, "SELI", 4);
+		writeSimple<std::uint8_t>(data, version);
+		writeArray<std::uint8_t>(data, zeros, 3);
+	}
+
 	template<typename T, int N>
 	Vec<T, N> readVec (const std::vector<std::uint8_t>& data, std::size_t& at) {
 		Vec<T, N> r;
@@ -124,5 +336,12 @@ namespace bio {
 			writeSimple(data, *it);
 		}
 	}
+
+	/// Same as the above, for collections that are contiguous in memory
+	template<typename T, typename Bytes=BufferedBinaryFileOutput<>>
+	void writeCollection (Bytes& data, const std::vector<T>& val) {
+		writeSimple<std::uint32_t>(data, std::uint32_t(val.size()));
+		writeArray<T>(data, val.data(), val.size());
+	}
 	
 }
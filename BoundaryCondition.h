@@ -4,6 +4,7 @@
 #include "Vec.h"
 #include "Particle.h"
 #include "BinaryIO.h"
+#include "JsonWriter.h"
 
 /// Represents the physical boundaries that restrict particle movement in 3D space
 template<int D>
@@ -20,7 +21,7 @@ public:
 	virtual void update(real_t surfaceVolume) = 0;
 	
 	// Process a particle that is meant to be kept attached to the boundary wall
-	virtual void updateAttachedParticles(std::vector<Particle<D>>& particles, real_t maximumAllowedDisplacement) = 0;
+	virtual void updateAttachedParticles(ParticleStore<D>& particles, real_t maximumAllowedDisplacement) = 0;
 	
 	// Returns the acceleration vector pushing the particle away from the boundary, if applicable
 	virtual Vec<real_t, D> force(const Vec<real_t, D>& position) = 0;
@@ -29,8 +30,8 @@ public:
 	// (this may happen if it's pushed outwards more than the force() can bring it in)
 	virtual void hard(Vec<real_t, D>& position) = 0;
 	
-	// Returns a json representation of the boundary condition
-	virtual std::string toJson() = 0;
+	// Writes a json representation of the boundary condition
+	virtual void toJson(JsonWriter& json) = 0;
 	
 	// Appends a binary representation of the boundary condition to the data stream
 	virtual void toBinary(bio::BufferedBinaryFileOutput<>& data) = 0;
@@ -4,7 +4,7 @@
 
 #include "real.h"
 
-class CylinderBoundary : public BoundaryCondition<3> {
+class CylinderBoundary final : public BoundaryCondition<3> {
 
 	real_t radius;
 	real_t maxRadius;
@@ -27,12 +27,13 @@ public:
 		}
 	}
 
-	void updateAttachedParticles(std::vector<Particle<3>>& particles, real_t maximumAllowedDisplacement) override {
-        Particle<3>* particle = &particles[0];
-        if (particle->attached) {
-            Vec<real_t, 2> target = particle->position.XY().normalized();
+	void updateAttachedParticles(ParticleStore<3>& particles, real_t maximumAllowedDisplacement) override {
+        if (particles.attached[0]) {
+            Vec3 position = particles.getPosition(0);
+            Vec<real_t, 2> target = position.XY().normalized();
             target *= radius;
-            particle->position.moveTowards(Vec3(target.X(), target.Y(), particle->position.Z()), maximumAllowedDisplacement);
+            position.moveTowards(Vec3(target.X(), target.Y(), position.Z()), maximumAllowedDisplacement);
+            particles.setPosition(0, position);
         }
 	}
 
@@ -56,8 +57,8 @@ public:
 		}
 	}
 
-	inline std::string toJson() override {
-		return "{ 'type': 'cylinder', 'radius': " + std::to_string(radius) + ", 'extent': " + std::to_string(extent) + " }";
+	inline void toJson(JsonWriter& json) override {
+		json.beginObject(true).field("type", "cylinder").field("radius", radius).field("extent", extent).endObject();
 	}
 	
 	inline void toBinary(bio::BufferedBinaryFileOutput<>& data) override {
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <vector>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "BinaryIO.h"
+#include "real.h"
+
+///
+/// Compact encoding of consecutive SEL v6 frames (-quantize): positions get quantized to a fixed-point grid and written as differences to the previous frame,
+/// and integer columns (topology) as edits to their previous values; all numbers are packed as zigzag varints
+/// Every keyframe (frame with KEYD = 0) starts over from empty previous values, so that a frame can be decoded from the last keyframe before it
+///
+/// Columns of an encoded frame:
+///   KEYD (uint32 x 1): frames since the last keyframe
+///   QPOS (uint8 bytes): quantum (float32), then for each particle & axis, q - reference, where q = round(position / quantum),
+///                       and the reference is the particle's q in the previous frame, or the previous particle's q for particles that are new (0 for the first)
+///   other names (uint8 bytes): edits turning the previous values of an int32 array into its current ones (see encodeEdits)
+///
+
+namespace delta {
+
+	inline std::uint64_t zigzag(std::int64_t v) {
+		return (std::uint64_t(v) << 1) ^ std::uint64_t(v >> 63);
+	}
+
+	inline std::int64_t unzigzag(std::uint64_t v) {
+		return std::int64_t(v >> 1) ^ -std::int64_t(v & 1);
+	}
+
+	/// Largest number of bytes a varint can take
+	constexpr std::size_t MaxVarintSize = 10;
+
+	/// Writes a varint at at, which must have room for MaxVarintSize bytes, and returns the position after it
+	inline std::uint8_t* writeVarint(std::uint8_t* at, std::uint64_t v) {
+		while (v >= 0x80) {
+			*at++ = std::uint8_t(v) | 0x80;
+			v >>= 7;
+		}
+		*at++ = std::uint8_t(v);
+		return at;
+	}
+
+	inline void writeVarint(std::vector<std::uint8_t>& out, std::uint64_t v) {
+		std::uint8_t bytes[MaxVarintSize];
+		out.insert(out.end(), bytes, writeVarint(bytes, v));
+	}
+
+	/// Reads a varint at at, moving it past it; returns false (leaving v unspecified) if it runs past end
+	inline bool readVarint(const std::uint8_t*& at, const std::uint8_t* end, std::uint64_t& v) {
+		v = 0;
+		for (int shift = 0; shift < 64 && at < end; shift += 7) {
+			std::uint8_t byte = *at++;
+			v |= std::uint64_t(byte & 0x7f) << shift;
+			if (byte < 0x80) return true;
+		}
+		return false;
+	}
+
+	/// Writes the edits from previous to current (count values): the new length, the number of changed values among those that were already there,
+	/// each change as (index gap since the last change, new value - old value), then the values past the previous length, each as a difference to the value before it
+	/// Arrays that only grow at the end, as most topology does, come down to their appended values
+	inline void encodeEdits(std::vector<std::uint8_t>& out, const std::vector<std::int32_t>& previous, const std::int32_t* current, std::size_t count) {
+		std::size_t common = std::min(previous.size(), count);
+		std::size_t changes = 0;
+		for (std::size_t i = 0; i < common; ++i) {
+			if (current[i] != previous[i]) ++changes;
+		}
+		writeVarint(out, count);
+		writeVarint(out, changes);
+		std::size_t last = 0;
+		for (std::size_t i = 0; i < common; ++i) {
+			if (current[i] == previous[i]) continue;
+			writeVarint(out, i - last);
+			writeVarint(out, zigzag(std::int64_t(current[i]) - previous[i]));
+			last = i;
+		}
+		for (std::size_t i = common; i < count; ++i) {
+			writeVarint(out, zigzag(std::int64_t(current[i]) - (i > 0 ? current[i - 1] : 0)));
+		}
+	}
+
+	/// Applies edits written by encodeEdits to values; returns false if they are malformed
+	inline bool decodeEdits(const std::uint8_t* at, const std::uint8_t* end, std::vector<std::int32_t>& values) {
+		std::uint64_t count, changes, v;
+		if (!readVarint(at, end, count) || !readVarint(at, end, changes) || changes > values.size()) return false;
+		if (count > values.size() + std::uint64_t(end - at)) return false; // every appended value takes a byte at least
+		std::size_t common = std::min(values.size(), std::size_t(count));
+		std::size_t i = 0;
+		for (std::uint64_t c = 0; c < changes; ++c) {
+			if (!readVarint(at, end, v)) return false;
+			i += std::size_t(v);
+			if (i >= common || !readVarint(at, end, v)) return false;
+			values[i] = std::int32_t(values[i] + unzigzag(v));
+		}
+		values.resize(std::size_t(count));
+		for (std::size_t j = common; j < values.size(); ++j) {
+			if (!readVarint(at, end, v)) return false;
+			values[j] = std::int32_t((j > 0 ? values[j - 1] : 0) + unzigzag(v));
+		}
+		return true;
+	}
+
+	/// Writes a QPOS column's contents, for the quantized positions current (particle-major) following previous
+	inline void encodePositions(std::vector<std::uint8_t>& out, float quantum, const std::vector<std::int32_t>& previous, const std::vector<std::int32_t>& current, int dimension) {
+		std::size_t start = out.size();
+		out.resize(start + sizeof(float) + current.size() * MaxVarintSize);
+		std::memcpy(out.data() + start, &quantum, sizeof(float));
+		std::uint8_t* at = out.data() + start + sizeof(float);
+		std::size_t common = std::min(previous.size(), current.size());
+		for (std::size_t v = 0; v < common; ++v) {
+			at = writeVarint(at, zigzag(std::int64_t(current[v]) - previous[v]));
+		}
+		for (std::size_t v = common; v < current.size(); ++v) {
+			at = writeVarint(at, zigzag(std::int64_t(current[v]) - (v >= std::size_t(dimension) ? current[v - dimension] : 0)));
+		}
+		out.resize(std::size_t(at - out.data()));
+	}
+
+	/// Applies a QPOS column to quantized (particle-major), resizing it to count particles of the given dimension; returns false if it is malformed
+	inline bool decodePositions(const std::uint8_t* at, const std::uint8_t* end, int dimension, std::size_t count, float& quantum, std::vector<std::int32_t>& quantized) {
+		if (end - at < std::ptrdiff_t(sizeof(float))) return false;
+		std::memcpy(&quantum, at, sizeof(float));
+		at += sizeof(float);
+		std::size_t previousCount = quantized.size() / dimension;
+		quantized.resize(count * dimension);
+		std::uint64_t v;
+		for (std::size_t i = 0; i < count; ++i) {
+			for (int a = 0; a < dimension; ++a) {
+				if (!readVarint(at, end, v)) return false;
+				std::int64_t reference = i < previousCount ? quantized[i * dimension + a] : i > 0 ? quantized[(i - 1) * dimension + a] : 0;
+				quantized[i * dimension + a] = std::int32_t(reference + unzigzag(v));
+			}
+		}
+		return true;
+	}
+
+}
+
+
+/// Encoder state carried over from frame to frame, for one output file
+template<int D>
+class SnapshotEncoder {
+
+protected:
+
+	real_t quantum = 0; // 0 when disabled
+	int keyframeInterval = 1;
+	int framesSinceKeyframe = -1;
+
+	std::vector<std::int32_t> quantized; // previous frame's quantized positions, particle-major
+	std::vector<std::int32_t> current; // scratch space for the current ones
+	std::vector<std::vector<std::int32_t>> columns; // previous values of the edited columns, by slot
+	std::vector<std::uint8_t> bytes; // scratch space for the column being encoded
+
+public:
+
+	/// Turns on compact encoding, with positions rounded to multiples of quantum, and a keyframe every keyframeInterval frames
+	void enable(real_t quantum, int keyframeInterval) {
+		this->quantum = quantum;
+		this->keyframeInterval = std::max(1, keyframeInterval);
+		framesSinceKeyframe = -1;
+	}
+
+	inline bool enabled() const { return quantum > 0; }
+
+	/// Starts encoding a new frame, and writes its KEYD column
+	template<typename Bytes>
+	void beginFrame(Bytes& data) {
+		if (++framesSinceKeyframe >= keyframeInterval) framesSinceKeyframe = 0;
+		if (framesSinceKeyframe == 0) {
+			quantized.clear();
+			for (auto& column : columns) column.clear();
+		}
+		std::uint32_t keyDistance = std::uint32_t(framesSinceKeyframe);
+		bio::writeColumn<std::uint32_t>(data, "KEYD", &keyDistance, 1, 1);
+	}
+
+	/// Writes the QPOS column, from positions given as structure-of-arrays (position[axis][particle])
+	/// Aborts if a position is too far from the origin for its multiple of quantum to fit an int32 (positions are only bounded by the grid, if at all)
+	template<typename Bytes>
+	void writePositions(Bytes& data, const std::array<std::vector<real_t>, D>& position, std::size_t count) {
+		current.resize(count * D);
+		for (std::size_t i = 0; i < count; ++i) {
+			for (int a = 0; a < D; ++a) {
+				double q = std::round(double(position[a][i]) / double(quantum));
+				if (!(std::abs(q) <= double(INT32_MAX))) { // also catches NaN
+					std::printf("Position %g of particle %zu can't be quantized to multiples of %g (-quantize too small), aborting.\n", double(position[a][i]), i, double(quantum));
+					std::exit(1);
+				}
+				current[i * D + a] = std::int32_t(q);
+			}
+		}
+		bytes.clear();
+		delta::encodePositions(bytes, float(quantum), quantized, current, D);
+		quantized.swap(current);
+		bio::writeColumn<std::uint8_t>(data, "QPOS", bytes.data(), 1, bytes.size());
+	}
+
+	/// Writes a column of edits to an int32 array; slot identifies the array from one frame to the next
+	template<typename Bytes>
+	void writeEdits(Bytes& data, const char (&name)[5], std::size_t slot, const std::int32_t* values, std::size_t count) {
+		if (columns.size() <= slot) columns.resize(slot + 1);
+		bytes.clear();
+		delta::encodeEdits(bytes, columns[slot], values, count);
+		columns[slot].assign(values, values + count);
+		bio::writeColumn<std::uint8_t>(data, name, bytes.data(), 1, bytes.size());
+	}
+
+};
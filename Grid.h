@@ -9,7 +9,43 @@
 
 
 
-/// Spatial data structure containing one vector of ints per cell, in N^D cells covering space between -0.5..0.5
+/// Contiguous range of values held in a single grid cell (empty for cells outside of the grid)
+struct CellRange {
+
+	const int* first = nullptr;
+	const int* last = nullptr;
+
+	inline const int* begin() const { return first; }
+	inline const int* end() const { return last; }
+	inline int size() const { return int(last - first); }
+
+};
+
+
+/// Whether neighbour i of the 3^D stencil (ternary digit per axis, x first: 0 -> same cell, 1 -> previous cell, 2 -> next cell) lies in the forward half,
+/// i.e. whether its last non-zero step is positive; each pair of opposite neighbours has exactly one of them in the forward half
+template<int D>
+constexpr bool isForwardNeighbour(int i) {
+	bool forward = false;
+	for (int a = 0; a < D; ++a) {
+		int digit = i % 3;
+		i /= 3;
+		if (digit != 0) forward = digit == 2;
+	}
+	return forward;
+}
+
+/// Number of cells returned when sampling half of the stencil: the home cell, and the forward half of its neighbours
+template<int D>
+constexpr int halfStencilSize() {
+	return (powConstexpr(3, D) + 1) / 2;
+}
+
+
+/// Spatial data structure containing the values in each of N^D cells covering space between -0.5..0.5
+/// Stored as a compressed cell list: values are kept in one contiguous array, with each cell referencing the range its values occupy
+/// Cells are only valid if stamped with the current build generation, so rebuilding only costs O(values) regardless of the number of cells
+/// Within a cell, values are kept in the order they were inserted in
 template<int D>
 class Grid {
 
@@ -18,7 +54,26 @@ protected:
 	/// Number of elements along one axis - grid size is resolution^D
 	int resolution;
 
-	std::vector<std::vector<int>> grid;
+	/// Per cell: offset of its first value in values, number of values, and generation at which the cell was last written to
+	std::vector<int> cellFirst;
+	std::vector<int> cellCounts;
+	std::vector<unsigned> cellStamp;
+	unsigned stamp = 1;
+
+	/// All values in the grid, grouped by cell (add() may leave unreferenced gaps until the next build)
+	std::vector<int> values;
+
+	/// Scratch space for build(): cell index for each value
+	std::vector<int> valueCells;
+
+	/// Precomputed 3^D neighbourhood, in ternary order (digit per axis, x first: 0 -> same cell, 1 -> previous cell, 2 -> next cell)
+	/// Per neighbour: offset of its cell index from the home cell, and bitmasks of the axes along which it steps down/up (to clip at the edges)
+	std::array<int, powConstexpr(3, D)> stencilOffsets;
+	std::array<std::uint8_t, powConstexpr(3, D)> stencilDown;
+	std::array<std::uint8_t, powConstexpr(3, D)> stencilUp;
+
+	/// Stencil neighbours returned by sampleHalf(), home cell first
+	std::array<int, halfStencilSize<D>()> halfStencil;
 
 	/// Given a position in D space, returns the cell index
 	inline int cellFromPosition(Vec<real_t, D> pos) const {
@@ -32,9 +87,9 @@ protected:
 	/// Given a number from 0 to pow(3, D), returns its ternary representation
 	inline void toTernary(int num, std::uint8_t digits[D]) {
 		assert(num >= 0 && num < powConstexpr(3, D));
-		
+
 		std::memset(digits, 0, D * sizeof(std::uint8_t));
-		
+
 		int i = 0;
 		do {
 			int remainder = num % 3;
@@ -44,59 +99,152 @@ protected:
 		} while (num >= 1);
 	}
 
+	/// Returns the values currently in a given cell
+	inline CellRange cellRange(int idx) const {
+		if (cellStamp[idx] != stamp) return CellRange();
+		const int* first = values.data() + cellFirst[idx];
+		return CellRange{ first, first + cellCounts[idx] };
+	}
+
 public:
 
 	/// Constructor, given a cell side length; will create a grid with ceil(1/cellSize)^D cells
 	Grid(real_t cellSize) {
 		resolution = int(ceil(1.0 / cellSize));
-		grid.resize(powConstexpr(resolution, D));
+		std::size_t cells = powConstexpr(resolution, D);
+		cellFirst.resize(cells);
+		cellCounts.resize(cells);
+		cellStamp.resize(cells, 0);
+
+		std::uint8_t digits[D];
+		for (int i = 0; i < powConstexpr(3, D); ++i) {
+			toTernary(i, digits);
+			stencilOffsets[i] = 0;
+			stencilDown[i] = stencilUp[i] = 0;
+			int stride = 1;
+			for (int a = 0; a < D; ++a) {
+				if (digits[a] == 1) {
+					stencilOffsets[i] -= stride;
+					stencilDown[i] |= std::uint8_t(1 << a);
+				} else if (digits[a] == 2) {
+					stencilOffsets[i] += stride;
+					stencilUp[i] |= std::uint8_t(1 << a);
+				}
+				stride *= resolution;
+			}
+		}
+
+		int h = 0;
+		for (int i = 0; i < powConstexpr(3, D); ++i) {
+			if (i == 0 || isForwardNeighbour<D>(i)) halfStencil[h++] = i;
+		}
 	}
 
-	/// Clears all of the neighbour lists in the grid
+	/// Empties all of the cells in the grid
 	void clear() {
-		for (auto& it : grid) {
-			it.resize(0); // spec enforces this preserves the allocated capacity of the vector vs .clear()
+		values.clear();
+		if (++stamp == 0) { // wrapped around, old stamps could now look valid
+			std::fill(cellStamp.begin(), cellStamp.end(), 0);
+			stamp = 1;
 		}
 	}
 
-	/// Adds a value to the relevant grid cell
+	/// Rebuilds the whole grid from scratch, with values 0..count-1 placed at the given positions (position[axis][value])
+	/// Counting sort over the occupied cells only: cell indices are computed in parallel, then cells are counted & given offsets in order of first occurrence,
+	/// and values scattered into place in ascending order
+	void build(const std::array<std::vector<real_t>, D>& position, int count) {
+		clear();
+
+		valueCells.resize(count);
+		#pragma omp parallel for
+		for (int i = 0; i < count; ++i) {
+			Vec<real_t, D> pos;
+			for (int a = 0; a < D; ++a) pos.set(a, position[a][i]);
+			valueCells[i] = cellFromPosition(pos);
+			assert(valueCells[i] >= 0);
+		}
+
+		// histogram, resetting cells the first time they're seen in this build
+		for (int i = 0; i < count; ++i) {
+			int c = valueCells[i];
+			if (cellStamp[c] != stamp) {
+				cellStamp[c] = stamp;
+				cellFirst[c] = -1;
+				cellCounts[c] = 0;
+			}
+			++cellCounts[c];
+		}
+
+		// offsets & scatter: cells get their range on first sight, then the counts are rebuilt as a write cursor into it
+		values.resize(count);
+		int total = 0;
+		for (int i = 0; i < count; ++i) {
+			int c = valueCells[i];
+			if (cellFirst[c] < 0) {
+				cellFirst[c] = total;
+				total += cellCounts[c];
+				cellCounts[c] = 0;
+			}
+			values[cellFirst[c] + cellCounts[c]++] = i;
+		}
+	}
+
+	/// Adds a value to the relevant grid cell, after any values already in it
+	/// If the cell's values aren't at the end of the value array, they get moved there first
 	void add(Vec<real_t, D> pos, int value) {
 		int idx = cellFromPosition(pos);
 		assert(idx >= 0);
-		assert((std::size_t)idx < grid.size());
-		grid[idx].push_back(value);
+		assert((std::size_t)idx < cellStamp.size());
+		if (cellStamp[idx] != stamp) {
+			cellStamp[idx] = stamp;
+			cellFirst[idx] = int(values.size());
+			cellCounts[idx] = 0;
+		} else if (cellFirst[idx] + cellCounts[idx] != int(values.size())) {
+			int first = int(values.size());
+			values.insert(values.end(), values.begin() + cellFirst[idx], values.begin() + cellFirst[idx] + cellCounts[idx]);
+			cellFirst[idx] = first;
+		}
+		values.push_back(value);
+		++cellCounts[idx];
 	}
 
-	/// Samples the grid, retaining the lists of neighbour cells
-	/// Returns the cell contents for the 3^D neighbouring cells:
-	void sample(Vec<real_t, D> pos, std::array<std::vector<int>*, powConstexpr(3, D)>& neighbours) {
+	/// Locates the home cell of a position, and which of its sides lie on the edges of the grid
+	inline int homeCell(Vec<real_t, D> pos, std::uint8_t& atLowEdge, std::uint8_t& atHighEdge) const {
 		assert(pos >= -0.5 && pos < 0.5);
-
-		// identity matrix divided by resolution
-		real_t d = (real_t)1 / resolution;
-		Vec<real_t, D> deltas[D];
-		for (int i = 0; i < D; ++i) {
-			deltas[i] = Vec<real_t, D>::Zero();
-			deltas[i].set(i, d);
+		pos += real_t(0.5);
+		pos *= real_t(resolution);
+		Vec<int, D> iPos = pos.floor();
+		atLowEdge = atHighEdge = 0;
+		for (int a = 0; a < D; ++a) {
+			if (iPos[a] <= 0) atLowEdge |= std::uint8_t(1 << a);
+			if (iPos[a] >= resolution - 1) atHighEdge |= std::uint8_t(1 << a);
 		}
+		return iPos.index(resolution);
+	}
 
-		// Add all possible permutations of +/-/0 dx/dy/dz/...
-		// i.e. pos + dx - dy, pos - dx, pos + dz, etc.
-		std::uint8_t digits[D];
+	/// Returns the contents of stencil neighbour i of a home cell (empty beyond the edges of the grid)
+	inline CellRange stencilRange(int home, int i, std::uint8_t atLowEdge, std::uint8_t atHighEdge) const {
+		bool clipped = (stencilDown[i] & atLowEdge) || (stencilUp[i] & atHighEdge);
+		return clipped ? CellRange() : cellRange(home + stencilOffsets[i]);
+	}
+
+	/// Samples the grid, retaining the ranges of values in neighbour cells
+	/// Returns the cell contents for the 3^D neighbouring cells (empty ranges for those beyond the edges of the grid):
+	void sample(Vec<real_t, D> pos, std::array<CellRange, powConstexpr(3, D)>& neighbours) {
+		std::uint8_t atLowEdge, atHighEdge;
+		int home = homeCell(pos, atLowEdge, atHighEdge);
 		for (int i = 0; i < powConstexpr(3, D); ++i) {
+			neighbours[i] = stencilRange(home, i, atLowEdge, atHighEdge);
+		}
+	}
 
-			// add offsets to position in the various axes
-			Vec<real_t, D> p = pos;
-			toTernary(i, digits);
-			for (int j = 0; j < D; ++j) {
-				assert(digits[j] < 3);
-				if (digits[j] == 1) p -= deltas[j];
-				else if (digits[j] == 2) p += deltas[j];
-			}
-			
-			// grab index (might be invalid at boundaries, in which case pass nullptr in results)
-			int idx = cellFromPosition(p);
-			neighbours[i] = idx < 0 ? nullptr : &grid[idx];
+	/// Samples half of the neighbourhood: the home cell first, then the forward half of its neighbours
+	/// Every pair of values in adjacent cells is found exactly once when sampling from each of them
+	void sampleHalf(Vec<real_t, D> pos, std::array<CellRange, halfStencilSize<D>()>& neighbours) {
+		std::uint8_t atLowEdge, atHighEdge;
+		int home = homeCell(pos, atLowEdge, atHighEdge);
+		for (int h = 0; h < halfStencilSize<D>(); ++h) {
+			neighbours[h] = stencilRange(home, halfStencil[h], atLowEdge, atHighEdge);
 		}
 	}
 
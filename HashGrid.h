@@ -0,0 +1,202 @@
+#pragma once
+
+#include <vector>
+#include <array>
+#include <cstdint>
+#include <cmath>
+
+#include "Grid.h"
+
+
+
+/// Spatial data structure with the same interface as Grid, but only storing the cells that are occupied, in an open-addressing hash table
+/// Cells have the same side length and alignment as in Grid, but cover all of space rather than -0.5..0.5, so positions never need to be clamped
+/// Cell coordinates are packed into the keys losslessly (up to +/-2^20 cells along each axis in 3D, +/-2^30 in 2D), so lookups are exact
+/// Keys leave their top bit clear, so that no cell, negative coordinates included, ever packs to EmptyKey
+template<int D>
+class HashGrid {
+
+protected:
+
+	static constexpr int KeyBits = 63 / D;
+	static constexpr std::uint64_t EmptyKey = ~std::uint64_t(0); // top bit set, which packKey never does
+
+	/// Number of cells along one axis within -0.5..0.5, i.e. 1 / cell size
+	int resolution;
+
+	/// Hash table slots: packed cell coordinates (or EmptyKey), offset of the cell's first value in values, and number of values
+	std::vector<std::uint64_t> slotKeys;
+	std::vector<int> slotFirst;
+	std::vector<int> slotCounts;
+	int occupiedSlots = 0;
+
+	/// All values in the grid, grouped by cell (add() may leave unreferenced gaps until the next build)
+	std::vector<int> values;
+
+	/// Scratch space for build(): packed cell coordinates & slot for each value
+	std::vector<std::uint64_t> valueKeys;
+	std::vector<int> valueSlots;
+
+	/// Given a position in D space, returns the integer coordinates of its cell
+	inline std::array<int, D> cellCoordinates(const Vec<real_t, D>& pos) const {
+		std::array<int, D> coords;
+		for (int a = 0; a < D; ++a) {
+			coords[a] = int(std::floor((pos[a] + real_t(0.5)) * real_t(resolution)));
+		}
+		return coords;
+	}
+
+	/// Packs cell coordinates into a single key
+	inline std::uint64_t packKey(const std::array<int, D>& coords) const {
+		std::uint64_t key = 0;
+		for (int a = 0; a < D; ++a) {
+			assert(coords[a] >= -(std::int64_t(1) << (KeyBits - 1)) && coords[a] < (std::int64_t(1) << (KeyBits - 1)));
+			key |= (std::uint64_t(std::uint32_t(coords[a])) & ((std::uint64_t(1) << KeyBits) - 1)) << (a * KeyBits);
+		}
+		return key;
+	}
+
+	/// Returns the slot holding a key, or the empty slot where it should be inserted
+	inline int findSlot(std::uint64_t key) const {
+		std::size_t mask = slotKeys.size() - 1;
+		std::size_t slot = std::size_t((key * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+		while (slotKeys[slot] != key && slotKeys[slot] != EmptyKey) {
+			slot = (slot + 1) & mask;
+		}
+		return int(slot);
+	}
+
+	/// Resizes the table so that it can hold at least the given number of cells at a load factor of at most 1/2, dropping all cells
+	inline void resetTable(std::size_t cells) {
+		std::size_t size = 16;
+		while (size < 2 * cells) size *= 2;
+		slotKeys.assign(size, EmptyKey);
+		slotFirst.resize(size);
+		slotCounts.resize(size);
+		occupiedSlots = 0;
+	}
+
+	/// Doubles the size of the table, keeping all cells
+	void grow() {
+		std::vector<std::uint64_t> keys = std::move(slotKeys);
+		std::vector<int> first = std::move(slotFirst);
+		std::vector<int> counts = std::move(slotCounts);
+		resetTable(keys.size());
+		for (std::size_t s = 0; s < keys.size(); ++s) if (keys[s] != EmptyKey) {
+			int slot = findSlot(keys[s]);
+			slotKeys[slot] = keys[s];
+			slotFirst[slot] = first[s];
+			slotCounts[slot] = counts[s];
+			++occupiedSlots;
+		}
+	}
+
+public:
+
+	/// Constructor, given a cell side length
+	HashGrid(real_t cellSize) {
+		resolution = int(ceil(1.0 / cellSize));
+		resetTable(0);
+	}
+
+	/// Empties all of the cells in the grid
+	void clear() {
+		values.clear();
+		std::fill(slotKeys.begin(), slotKeys.end(), EmptyKey);
+		occupiedSlots = 0;
+	}
+
+	/// Rebuilds the whole grid from scratch, with values 0..count-1 placed at the given positions (position[axis][value])
+	/// Same counting sort as Grid::build, with cells looked up in the hash table
+	void build(const std::array<std::vector<real_t>, D>& position, int count) {
+		values.clear();
+		resetTable(count);
+
+		valueKeys.resize(count);
+		#pragma omp parallel for
+		for (int i = 0; i < count; ++i) {
+			Vec<real_t, D> pos;
+			for (int a = 0; a < D; ++a) pos.set(a, position[a][i]);
+			valueKeys[i] = packKey(cellCoordinates(pos));
+		}
+
+		// histogram
+		valueSlots.resize(count);
+		for (int i = 0; i < count; ++i) {
+			int slot = findSlot(valueKeys[i]);
+			if (slotKeys[slot] == EmptyKey) {
+				slotKeys[slot] = valueKeys[i];
+				slotFirst[slot] = -1;
+				slotCounts[slot] = 0;
+				++occupiedSlots;
+			}
+			++slotCounts[slot];
+			valueSlots[i] = slot;
+		}
+
+		// offsets & scatter
+		values.resize(count);
+		int total = 0;
+		for (int i = 0; i < count; ++i) {
+			int slot = valueSlots[i];
+			if (slotFirst[slot] < 0) {
+				slotFirst[slot] = total;
+				total += slotCounts[slot];
+				slotCounts[slot] = 0;
+			}
+			values[slotFirst[slot] + slotCounts[slot]++] = i;
+		}
+	}
+
+	/// Adds a value to the relevant grid cell, after any values already in it
+	void add(Vec<real_t, D> pos, int value) {
+		if (2 * (occupiedSlots + 1) > int(slotKeys.size())) grow();
+		std::uint64_t key = packKey(cellCoordinates(pos));
+		int slot = findSlot(key);
+		if (slotKeys[slot] == EmptyKey) {
+			slotKeys[slot] = key;
+			slotFirst[slot] = int(values.size());
+			slotCounts[slot] = 0;
+			++occupiedSlots;
+		} else if (slotFirst[slot] + slotCounts[slot] != int(values.size())) {
+			int first = int(values.size());
+			values.insert(values.end(), values.begin() + slotFirst[slot], values.begin() + slotFirst[slot] + slotCounts[slot]);
+			slotFirst[slot] = first;
+		}
+		values.push_back(value);
+		++slotCounts[slot];
+	}
+
+	/// Returns the contents of stencil neighbour i of a home cell, in the same order as Grid
+	inline CellRange stencilRange(const std::array<int, D>& home, int i) const {
+		std::array<int, D> coords = home;
+		for (int a = 0; a < D; ++a) {
+			int digit = i % 3;
+			i /= 3;
+			coords[a] += digit == 1 ? -1 : digit == 2 ? 1 : 0;
+		}
+		int slot = findSlot(packKey(coords));
+		if (slotKeys[slot] == EmptyKey) return CellRange();
+		const int* first = values.data() + slotFirst[slot];
+		return CellRange{ first, first + slotCounts[slot] };
+	}
+
+	/// Samples the grid, retaining the ranges of values in neighbour cells
+	/// Returns the cell contents for the 3^D neighbouring cells, in the same order as Grid::sample
+	void sample(Vec<real_t, D> pos, std::array<CellRange, powConstexpr(3, D)>& neighbours) {
+		std::array<int, D> home = cellCoordinates(pos);
+		for (int i = 0; i < powConstexpr(3, D); ++i) {
+			neighbours[i] = stencilRange(home, i);
+		}
+	}
+
+	/// Samples half of the neighbourhood: the home cell first, then the forward half of its neighbours, as in Grid::sampleHalf
+	void sampleHalf(Vec<real_t, D> pos, std::array<CellRange, halfStencilSize<D>()>& neighbours) {
+		std::array<int, D> home = cellCoordinates(pos);
+		int h = 0;
+		for (int i = 0; i < powConstexpr(3, D); ++i) {
+			if (i == 0 || isForwardNeighbour<D>(i)) neighbours[h++] = stencilRange(home, i);
+		}
+	}
+
+};
@@ -0,0 +1,97 @@
+#include "JsonWriter.h"
+
+#include <cstdlib>
+
+
+void JsonWriter::beginItem() {
+	Scope& scope = scopes.back();
+	if (scope.inlineItems) {
+		text += scope.empty ? " " : ", ";
+	} else {
+		text += scope.empty ? "\n" : ",\n";
+		text.append(scopes.size(), '\t');
+	}
+	scope.empty = false;
+}
+
+void JsonWriter::open(char bracket, bool inlineItems) {
+	beginValue();
+	text += bracket;
+	scopes.push_back({ inlineItems, true });
+}
+
+void JsonWriter::close(char bracket) {
+	Scope scope = scopes.back();
+	scopes.pop_back();
+	if (!scope.empty) {
+		if (scope.inlineItems) {
+			text += ' ';
+		} else {
+			text += '\n';
+			text.append(scopes.size(), '\t');
+		}
+	}
+	text += bracket;
+}
+
+JsonWriter& JsonWriter::key(const char* name) {
+	beginItem();
+	text += '"';
+	text += name;
+	text += "\": ";
+	afterKey = true;
+	return *this;
+}
+
+JsonWriter& JsonWriter::value(const char* v) {
+	beginValue();
+	text += '"';
+	for (const char* c = v; *c; ++c) {
+		switch (*c) {
+		case '"':	text += "\\\"";	break;
+		case '\\':	text += "\\\\";	break;
+		case '\n':	text += "\\n";	break;
+		case '\r':	text += "\\r";	break;
+		case '\t':	text += "\\t";	break;
+		default:
+			if (static_cast<unsigned char>(*c) < 0x20) {
+				char escaped[8];
+				std::snprintf(escaped, sizeof(escaped), "\\u%04x", unsigned(static_cast<unsigned char>(*c)));
+				text += escaped;
+			} else {
+				text += *c;
+			}
+		}
+	}
+	text += '"';
+	return *this;
+}
+
+
+JsonArrayFile::JsonArrayFile(const std::string& filename) {
+#ifndef _MSC_VER
+	file = std::fopen(filename.c_str(), "wb");
+#else
+	if (fopen_s(&file, filename.c_str(), "wb") != 0) file = nullptr;
+#endif
+	if (!file) {
+		std::printf("File %s could not be open for write, aborting.\n", filename.c_str());
+		std::exit(1);
+	}
+	std::fputs("[\n]", file);
+	std::fflush(file);
+}
+
+JsonArrayFile::~JsonArrayFile() {
+	std::fclose(file);
+}
+
+void JsonArrayFile::append(const std::string& element) {
+	// step back over "]" (empty array) or "\n]" (after the last element), then close the array again after the new element
+	std::fseek(file, elements == 0 ? -1 : -2, SEEK_END);
+	if (elements > 0) std::fputs(",\n", file);
+	std::fwrite(element.data(), sizeof(char), element.size(), file);
+	std::fputs("\n]", file);
+	std::fflush(file);
+	++elements;
+}
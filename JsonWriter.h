@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstdio>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <charconv>
+#include <limits>
+#include <type_traits>
+
+#include "Vec.h"
+
+///
+/// JSON output (-json), for the WebGL viewer
+/// Snapshots get built one at a time into a JsonWriter that is reused from one snapshot to the next,
+/// then appended to a JsonArrayFile holding the array of all snapshots so far
+///
+
+/// Builds JSON text into a buffer, taking care of separators and indentation
+/// Numbers are formatted with std::to_chars, as the shortest text reading back to the same value
+/// (standard libraries without floating-point std::to_chars, e.g. before GCC 11, print max_digits10 significant digits instead, which read back the same but may be longer)
+class JsonWriter {
+private:
+
+	struct Scope {
+		bool inlineItems; // items on a single line, rather than one per line
+		bool empty;
+	};
+
+	std::string text;
+	std::vector<Scope> scopes; // objects & arrays currently open
+	bool afterKey = false;
+
+	/// Writes what goes in front of an item of the innermost scope: separator, then line break and indentation unless it is inline
+	void beginItem();
+	/// Writes what goes in front of a value: nothing after a key, beginItem() in an array
+	inline void beginValue() {
+		if (afterKey) afterKey = false;
+		else if (!scopes.empty()) beginItem();
+	}
+	void open(char bracket, bool inlineItems);
+	void close(char bracket);
+
+	template<typename T>
+	inline void number(T value) {
+		char buffer[32];
+	#if !defined(__cpp_lib_to_chars) || __cpp_lib_to_chars < 201611L // floating-point std::to_chars missing
+		if constexpr (std::is_floating_point<T>::value) {
+			int length = std::snprintf(buffer, sizeof(buffer), "%.*g", std::numeric_limits<T>::max_digits10, double(value));
+			text.append(buffer, std::size_t(length));
+		} else
+	#endif
+		{
+			std::to_chars_result result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+			text.append(buffer, result.ptr);
+		}
+	}
+
+public:
+
+	/// Empties the text, keeping its storage for the next value
+	inline void clear() {
+		text.clear();
+		scopes.clear();
+		afterKey = false;
+	}
+
+	inline const std::string& str() const { return text; }
+
+	inline JsonWriter& beginObject(bool inlineItems = false) { open('{', inlineItems); return *this; }
+	inline JsonWriter& endObject() { close('}'); return *this; }
+	inline JsonWriter& beginArray(bool inlineItems = false) { open('[', inlineItems); return *this; }
+	inline JsonWriter& endArray() { close(']'); return *this; }
+
+	/// Writes the key of the next member of the innermost object (name is written as is, without escaping)
+	JsonWriter& key(const char* name);
+
+	inline JsonWriter& value(int v) { beginValue(); number(v); return *this; }
+	inline JsonWriter& value(long long v) { beginValue(); number(v); return *this; }
+	inline JsonWriter& value(bool v) { beginValue(); text += v ? "true" : "false"; return *this; }
+	inline JsonWriter& null() { beginValue(); text += "null"; return *this; }
+	/// Non-finite numbers, which JSON has no notation for, are written as null
+	template<typename T, typename std::enable_if<std::is_floating_point<T>::value, int>::type = 0>
+	inline JsonWriter& value(T v) {
+		if (!std::isfinite(v)) return null();
+		beginValue();
+		number(v);
+		return *this;
+	}
+	JsonWriter& value(const char* v);
+	inline JsonWriter& value(const std::string& v) { return value(v.c_str()); }
+
+	/// Writes a vector as an inline array of its components
+	template<typename T, int N>
+	JsonWriter& value(const Vec<T, N>& v) {
+		beginArray(true);
+		for (int i = 0; i < N; ++i) value(v[i]);
+		return endArray();
+	}
+
+	/// Writes a member of the innermost object
+	template<typename T>
+	inline JsonWriter& field(const char* name, const T& v) {
+		key(name);
+		return value(v);
+	}
+
+};
+
+
+/// File holding a JSON array that grows one element at a time
+/// Each element is written at the end of the file over the closing bracket, which then gets written again after it,
+/// so that the file holds a complete array after every append, without rewriting the elements before it
+class JsonArrayFile {
+private:
+	std::FILE* file = nullptr;
+	std::size_t elements = 0;
+
+public:
+
+	/// Creates the file, with an empty array, aborting if it can't be written
+	JsonArrayFile(const std::string& filename);
+	~JsonArrayFile();
+
+	JsonArrayFile(const JsonArrayFile&) = delete;
+	JsonArrayFile& operator=(const JsonArrayFile&) = delete;
+
+	/// Appends the JSON text of an element to the array, and flushes the file
+	void append(const std::string& element);
+
+	inline std::size_t size() const { return elements; }
+
+};
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <vector>
+#include <array>
+#include <unordered_map>
+#include <cassert>
+
+#include "Vec.h"
+
+
+/// Edge -> triangle connectivity of a closed, consistently oriented triangle mesh
+/// Triangles are kept in the caller's triangle list; alongside them, this stores the triangle across each of their edges and one triangle per vertex,
+/// so that the triangles around an edge or a vertex are found by walking locally instead of scanning the whole list
+/// Half-edge k of triangle t goes from triangles[t][k] to triangles[t][(k + 1) % 3]; its twin is the reverse edge in neighbours[t][k]
+class MeshConnectivity {
+
+protected:
+
+	/// Per triangle, the triangle across edges X->Y, Y->Z and Z->X
+	std::vector<std::array<int, 3>> neighbours;
+
+	/// Per vertex, a triangle using it (walks start from there)
+	std::vector<int> vertexTriangles;
+
+	/// Rotates the vertices (and neighbours) of triangle t so that it starts with the given vertex, keeping its orientation
+	static inline void rotateTo(int t, int vertex, std::vector<IVec3>& triangles, std::vector<std::array<int, 3>>& neighbours) {
+		while (triangles[t][0] != vertex) {
+			triangles[t] = IVec3(triangles[t][1], triangles[t][2], triangles[t][0]);
+			neighbours[t] = { neighbours[t][1], neighbours[t][2], neighbours[t][0] };
+		}
+	}
+
+	/// Points the edge of triangle t that was shared with triangle from to triangle to instead
+	inline void replaceNeighbour(int t, int from, int to) {
+		for (int k = 0; k < 3; ++k) {
+			if (neighbours[t][k] == from) neighbours[t][k] = to;
+		}
+	}
+
+	/// Sets the triangle across edge from -> to of triangle t
+	inline void setNeighbour(const std::vector<IVec3>& triangles, int t, int from, int to, int n) {
+		for (int k = 0; k < 3; ++k) {
+			if (triangles[t][k] == from && triangles[t][(k + 1) % 3] == to) neighbours[t][k] = n;
+		}
+	}
+
+	/// Index of the given vertex within triangle t
+	static inline int cornerOf(const std::vector<IVec3>& triangles, int t, int vertex) {
+		return triangles[t][0] == vertex ? 0 : triangles[t][1] == vertex ? 1 : 2;
+	}
+
+public:
+
+	/// Whether the connectivity has been built yet
+	inline bool empty() const { return neighbours.empty(); }
+
+	/// Builds the triangle adjacency for a closed triangle mesh over vertexCount vertices
+	void build(const std::vector<IVec3>& triangles, int vertexCount) {
+		neighbours.assign(triangles.size(), { -1, -1, -1 });
+		vertexTriangles.assign(vertexCount, -1);
+
+		std::unordered_map<long long, int> halfEdges; // (from, to) -> triangle * 3 + edge
+		halfEdges.reserve(triangles.size() * 3);
+		auto key = [](int from, int to) { return (long long)from << 32 | (unsigned)to; };
+		for (std::size_t t = 0; t < triangles.size(); ++t) {
+			for (int k = 0; k < 3; ++k) {
+				halfEdges[key(triangles[t][k], triangles[t][(k + 1) % 3])] = int(t) * 3 + k;
+				vertexTriangles[triangles[t][k]] = int(t);
+			}
+		}
+		for (std::size_t t = 0; t < triangles.size(); ++t) {
+			for (int k = 0; k < 3; ++k) {
+				auto twin = halfEdges.find(key(triangles[t][(k + 1) % 3], triangles[t][k]));
+				assert(twin != halfEdges.end());
+				neighbours[t][k] = twin->second / 3;
+			}
+		}
+	}
+
+	/// Calls f(t) for each triangle t around a vertex (its one-ring), in counter-clockwise order seen from outside
+	template<typename F>
+	inline void forEachTriangleAround(const std::vector<IVec3>& triangles, int vertex, F f) const {
+		int first = vertexTriangles[vertex];
+		int t = first;
+		do {
+			f(t);
+			// the next triangle around shares the edge leaving the vertex backwards (previous corner -> vertex)
+			t = neighbours[t][(cornerOf(triangles, t, vertex) + 2) % 3];
+		} while (t != first);
+	}
+
+	/// Returns triangle * 3 + edge for the half-edge from -> to, walking around vertex from (-1 if the two aren't connected)
+	inline int findHalfEdge(const std::vector<IVec3>& triangles, int from, int to) const {
+		int found = -1;
+		forEachTriangleAround(triangles, from, [&](int t) {
+			int k = cornerOf(triangles, t, from);
+			if (triangles[t][(k + 1) % 3] == to) found = t * 3 + k;
+		});
+		return found;
+	}
+
+	/// Picks one of the mesh's edges uniformly at random given r in 0..1, returning its end points
+	/// Every edge has one half-edge on either side, so picking a half-edge uniformly picks each edge with the same probability
+	inline void randomEdge(const std::vector<IVec3>& triangles, real_t r, int& a, int& b) const {
+		std::size_t halfEdge = std::min(std::size_t(r * real_t(3 * triangles.size())), 3 * triangles.size() - 1);
+		const IVec3& tri = triangles[halfEdge / 3];
+		a = tri[int(halfEdge % 3)];
+		b = tri[int(halfEdge % 3 + 1) % 3];
+	}
+
+	/// Splits edge a-b at new vertex c: each of the two triangles around it keeps the half on b's side and appends the half on a's side
+	/// The triangles around the edge are handled in list order, and keep the vertex order that they had; onSplit(t, opposite) is called for each of them
+	template<typename F>
+	void splitEdge(std::vector<IVec3>& triangles, int a, int b, int c, F onSplit) {
+		int ab = findHalfEdge(triangles, a, b);
+		int ba = findHalfEdge(triangles, b, a);
+		assert(ab >= 0 && ba >= 0);
+		vertexTriangles.resize(std::max<std::size_t>(vertexTriangles.size(), std::size_t(c) + 1), -1);
+
+		// split triangle (x, y, z) along half-edge x -> y: in place (c, y, z), appended (x, c, z)
+		std::array<int, 2> halfEdges = { ab, ba };
+		if (ba < ab) std::swap(halfEdges[0], halfEdges[1]);
+		std::array<int, 2> kept, added;
+		std::array<int, 2> from, to;
+		for (int s = 0; s < 2; ++s) {
+			int t = halfEdges[s] / 3, k = halfEdges[s] % 3;
+			int x = triangles[t][k], y = triangles[t][(k + 1) % 3], z = triangles[t][(k + 2) % 3];
+			int nYZ = neighbours[t][(k + 1) % 3], nZX = neighbours[t][(k + 2) % 3];
+			int n = int(triangles.size());
+
+			IVec3 appended = triangles[t];
+			appended.set((k + 1) % 3, c);
+			if (k == 2) appended = IVec3(appended[2], appended[0], appended[1]); // (f, c, e) rather than (c, e, f), as the original triangle scan did
+			triangles[t].set(k, c);
+			triangles.push_back(appended);
+			neighbours.push_back({ -1, -1, -1 });
+
+			setNeighbour(triangles, t, y, z, nYZ);
+			setNeighbour(triangles, t, z, c, n);
+			setNeighbour(triangles, n, c, z, t);
+			setNeighbour(triangles, n, z, x, nZX);
+			replaceNeighbour(nZX, t, n);
+			vertexTriangles[x] = n;
+			vertexTriangles[y] = t;
+			vertexTriangles[c] = t;
+
+			kept[s] = t;	added[s] = n;
+			from[s] = x;	to[s] = y;
+			onSplit(t, z);
+		}
+
+		// the two halves on each side of the old edge face each other across c
+		for (int s = 0; s < 2; ++s) {
+			setNeighbour(triangles, kept[s], c, to[s], added[1 - s]);
+			setNeighbour(triangles, added[s], from[s], c, kept[1 - s]);
+		}
+	}
+
+};
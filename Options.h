@@ -4,3 +4,7 @@
 // #define NO_UPDATE // define to only produce final tessellated mesh without any in-between updates
 
 #define USE_GRID // define to use grid spatial data structure to only update relevant particles
+
+// #define USE_HASH_GRID // define to store the grid as a sparse hash table of occupied cells, without any domain bounds (otherwise, a dense grid covers -0.5..0.5 and positions get clamped to it)
+
+// #define ATOMIC_NORMALS // define to accumulate vertex normals by scattering each face normal to its vertices with atomic adds (otherwise, each vertex gathers the face normals around it)
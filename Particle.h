@@ -1,8 +1,14 @@
 #pragma once
 
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <type_traits>
+
 #include "Vec.h"
 
 /// Represents a single vertex-particle on the evolving n-dimensional selfavoiding surface
+/// Used to construct new particles; surfaces keep all of their particles in a ParticleStore
 template<int D>
 struct Particle {
 
@@ -12,10 +18,8 @@ struct Particle {
 
 	Vec<real_t, D> position; // Position in n-dimensional space
 
-	Vec3 spherical; // Position on unit sphere (for spherical Delaunay triangulation)
-    
 	bool attached = false; // If true, the specific particle should be considered attached to the nearest boundary wall
-    
+
     real_t flexibility = 1.0; // 0..1
 
 	/// Helper factory to construct new particles
@@ -23,7 +27,6 @@ struct Particle {
 		Particle p;
 		p.position = pos;
 		p.velocity = p.acceleration = Vec<real_t, D>::Zero();
-		p.spherical = Vec3::Zero();
 		return p;
 	}
 
@@ -31,8 +34,79 @@ struct Particle {
 	static inline Particle Zero() {
 		Particle p;
 		p.position = p.velocity = p.acceleration = Vec<real_t, D>::Zero();
-		p.spherical = Vec3::Zero();
 		return p;
 	}
 
 };
+
+
+/// Structure-of-arrays storage for the particles that make up a surface
+/// Each vector quantity is kept as one contiguous array per axis, so passes over a few quantities only pull those into cache
+template<int D>
+struct ParticleStore {
+
+	std::array<std::vector<real_t>, D> acceleration; // acceleration[axis][particle]
+
+	std::array<std::vector<real_t>, D> velocity; // velocity[axis][particle]
+
+	std::array<std::vector<real_t>, D> position; // position[axis][particle]
+
+	std::vector<std::uint8_t> attached; // Non-zero if the particle should be considered attached to the nearest boundary wall
+
+	std::vector<real_t> flexibility; // 0..1
+
+	inline std::size_t size() const { return flexibility.size(); }
+
+	inline void reserve(std::size_t capacity) {
+		for (int a = 0; a < D; ++a) {
+			acceleration[a].reserve(capacity);
+			velocity[a].reserve(capacity);
+			position[a].reserve(capacity);
+		}
+		attached.reserve(capacity);
+		flexibility.reserve(capacity);
+	}
+
+	/// Appends a particle at the end of the store
+	inline void push_back(const Particle<D>& p) {
+		for (int a = 0; a < D; ++a) {
+			acceleration[a].push_back(p.acceleration[a]);
+			velocity[a].push_back(p.velocity[a]);
+			position[a].push_back(p.position[a]);
+		}
+		attached.push_back(p.attached ? 1 : 0);
+		flexibility.push_back(p.flexibility);
+	}
+
+	/// Reorders the particles so that particle order[i] becomes particle i (order being a permutation of all particles)
+	void permute(const std::vector<int>& order) {
+		auto apply = [&](auto& values) {
+			std::remove_reference_t<decltype(values)> permuted(values.size());
+			for (std::size_t i = 0; i < order.size(); ++i) permuted[i] = values[order[i]];
+			values.swap(permuted);
+		};
+		for (int a = 0; a < D; ++a) {
+			apply(acceleration[a]);
+			apply(velocity[a]);
+			apply(position[a]);
+		}
+		apply(attached);
+		apply(flexibility);
+	}
+
+	// Per-particle vector accessors, gathering/scattering the components across the per-axis arrays
+#define PARTICLE_STORE_VEC_ACCESSORS(Name, field) \
+	inline Vec<real_t, D> get ## Name(int i) const { \
+		Vec<real_t, D> v; \
+		for (int a = 0; a < D; ++a) v.set(a, field[a][i]); \
+		return v; \
+	} \
+	inline void set ## Name(int i, const Vec<real_t, D>& v) { \
+		for (int a = 0; a < D; ++a) field[a][i] = v[a]; \
+	}
+	PARTICLE_STORE_VEC_ACCESSORS(Acceleration, acceleration)
+	PARTICLE_STORE_VEC_ACCESSORS(Velocity, velocity)
+	PARTICLE_STORE_VEC_ACCESSORS(Position, position)
+#undef PARTICLE_STORE_VEC_ACCESSORS
+
+};
@@ -0,0 +1,93 @@
+#include "RepulsionKernel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+	template<int D, bool Anisotropic>
+	inline void evaluateLanes(real_t (&towards)[D][RepulsionLanes<D>::Width], const real_t (&radius)[RepulsionLanes<D>::Width], const real_t* anisotropy) {
+		constexpr int Width = RepulsionLanes<D>::Width;
+
+		// work on local copies, so the compiler doesn't have to assume the inputs and outputs may overlap
+		real_t t[D][Width], r[Width];
+		for (int k = 0; k < Width; ++k) r[k] = radius[k];
+		for (int a = 0; a < D; ++a) for (int k = 0; k < Width; ++k) t[a][k] = towards[a][k];
+
+		// squared distances, summed in the same order as Vec::lengthSqr()
+		real_t d2[Width];
+		for (int k = 0; k < Width; ++k) d2[k] = 0;
+		for (int a = 0; a < D; ++a) for (int k = 0; k < Width; ++k) d2[k] += t[a][k] * t[a][k];
+
+		// a zero distance only happens with a zero vector, which is left as-is by dividing it by the smallest normal float instead
+		real_t d[Width], divisor[Width];
+		for (int k = 0; k < Width; ++k) d[k] = std::sqrt(d2[k]);
+		for (int k = 0; k < Width; ++k) divisor[k] = std::max(d[k], std::numeric_limits<real_t>::min());
+
+		// normalize & scale by the overlap and anisotropy for all lanes, then mask out candidates beyond their radius
+		// (two separate passes, so that the division isn't moved behind the mask and left unvectorized)
+		for (int a = 0; a < D; ++a) {
+			if constexpr (Anisotropic) {
+				const real_t aniso = anisotropy[a];
+				for (int k = 0; k < Width; ++k) t[a][k] = t[a][k] / divisor[k] * (d[k] - r[k]) * aniso;
+			} else {
+				for (int k = 0; k < Width; ++k) t[a][k] = t[a][k] / divisor[k] * (d[k] - r[k]);
+			}
+		}
+		for (int a = 0; a < D; ++a) {
+			for (int k = 0; k < Width; ++k) towards[a][k] = d2[k] < r[k] * r[k] ? t[a][k] : real_t(-0.0);
+		}
+	}
+
+	void evaluateLanes2(real_t (&towards)[2][RepulsionLanes<2>::Width], const real_t (&radius)[RepulsionLanes<2>::Width], const real_t (&anisotropy)[2]) {
+		evaluateLanes<2, true>(towards, radius, anisotropy);
+	}
+
+	void evaluateLanes3(real_t (&towards)[3][RepulsionLanes<3>::Width], const real_t (&radius)[RepulsionLanes<3>::Width], const real_t (&anisotropy)[3]) {
+		evaluateLanes<3, true>(towards, radius, anisotropy);
+	}
+
+	void evaluateIsotropicLanes2(real_t (&towards)[2][RepulsionLanes<2>::Width], const real_t (&radius)[RepulsionLanes<2>::Width]) {
+		evaluateLanes<2, false>(towards, radius, nullptr);
+	}
+
+	void evaluateIsotropicLanes3(real_t (&towards)[3][RepulsionLanes<3>::Width], const real_t (&radius)[RepulsionLanes<3>::Width]) {
+		evaluateLanes<3, false>(towards, radius, nullptr);
+	}
+
+	// Clears the lanes that haven't been filled in, so that they fall out of range
+	template<int D>
+	inline void padLanes(RepulsionLanes<D>& lanes) {
+		for (int k = lanes.count; k < RepulsionLanes<D>::Width; ++k) {
+			for (int a = 0; a < D; ++a) lanes.towards[a][k] = real_t(0);
+			lanes.radius[k] = real_t(0);
+		}
+	}
+
+}
+
+
+template<>
+void RepulsionLanes<2>::evaluate(const real_t (&anisotropy)[2]) {
+	padLanes(*this);
+	evaluateLanes2(towards, radius, anisotropy);
+}
+
+template<>
+void RepulsionLanes<3>::evaluate(const real_t (&anisotropy)[3]) {
+	padLanes(*this);
+	evaluateLanes3(towards, radius, anisotropy);
+}
+
+template<>
+void RepulsionLanes<2>::evaluate() {
+	padLanes(*this);
+	evaluateIsotropicLanes2(towards, radius);
+}
+
+template<>
+void RepulsionLanes<3>::evaluate() {
+	padLanes(*this);
+	evaluateIsotropicLanes3(towards, radius);
+}
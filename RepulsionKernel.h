@@ -0,0 +1,36 @@
+#pragma once
+
+#include "real.h"
+
+
+/// Fixed-width batch of candidate pairs for the non-neighbour repulsion force
+/// Candidates for a given particle are gathered into lanes so that distances, masks and forces can be evaluated for all lanes at once
+template<int D>
+struct RepulsionLanes {
+
+	static constexpr int Width = 8;
+
+	// Vector from the particle to each candidate, one array per axis; overwritten with the repulsion force by evaluate()
+	real_t towards[D][Width];
+
+	// Repulsion radius to use for each candidate
+	real_t radius[Width];
+
+	// Number of lanes currently filled in
+	int count = 0;
+
+	/// Computes the repulsion force for every filled lane, scaled by the anisotropy vector
+	/// Lanes out of range of their candidate are set to -0, so that their force can be accumulated as-is without changing the sum
+	void evaluate(const real_t (&anisotropy)[D]);
+
+	/// Same as above, without any anisotropy
+	void evaluate();
+
+};
+
+
+// Lane kernels are only defined for 2D & 3D, in RepulsionKernel.cpp
+template<> void RepulsionLanes<2>::evaluate(const real_t (&anisotropy)[2]);
+template<> void RepulsionLanes<3>::evaluate(const real_t (&anisotropy)[3]);
+template<> void RepulsionLanes<2>::evaluate();
+template<> void RepulsionLanes<3>::evaluate();
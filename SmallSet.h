@@ -0,0 +1,77 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <algorithm>
+#include <initializer_list>
+
+
+/// Small set of values, stored contiguously in insertion order
+/// Up to N values are kept inline (no allocation); past that, all values move to the heap and stay there
+/// Meant for per-particle adjacency, where lookups are linear scans over a handful of values
+template<typename T, int N>
+class SmallSet {
+
+protected:
+
+	std::array<T, N> local{};
+	std::vector<T> overflow; // only used once more than N values have been inserted at some point
+	int count = 0;
+	bool spilled = false;
+
+	inline T* data() { return spilled ? overflow.data() : local.data(); }
+	inline const T* data() const { return spilled ? overflow.data() : local.data(); }
+
+public:
+
+	using const_iterator = const T*;
+
+	SmallSet() { }
+
+	SmallSet(std::initializer_list<T> values) {
+		for (const T& v : values) insert(v);
+	}
+
+	inline const_iterator begin() const { return data(); }
+	inline const_iterator end() const { return data() + count; }
+	inline std::size_t size() const { return std::size_t(count); }
+	inline bool empty() const { return count == 0; }
+
+	inline bool contains(const T& v) const {
+		return std::find(begin(), end(), v) != end();
+	}
+
+	/// Adds a value at the end if it isn't in the set yet; returns whether it was added
+	inline bool insert(const T& v) {
+		if (contains(v)) return false;
+		if (!spilled && count == N) {
+			overflow.assign(local.begin(), local.end());
+			spilled = true;
+		}
+		if (spilled) {
+			overflow.push_back(v);
+		} else {
+			local[count] = v;
+		}
+		++count;
+		return true;
+	}
+
+	/// Removes a value, keeping the remaining values in order; returns the number of values removed (0 or 1)
+	inline std::size_t erase(const T& v) {
+		T* first = data();
+		T* it = std::find(first, first + count, v);
+		if (it == first + count) return 0;
+		std::copy(it + 1, first + count, it);
+		--count;
+		if (spilled) overflow.pop_back();
+		return 1;
+	}
+
+	/// Removes all values, keeping any heap storage for reuse
+	inline void clear() {
+		count = 0;
+		overflow.clear();
+	}
+
+};
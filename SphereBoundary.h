@@ -8,7 +8,7 @@
 
 /// Represents a soft spherical boundary
 template<int D>
-class SphereBoundary : public BoundaryCondition<D> {
+class SphereBoundary final : public BoundaryCondition<D> {
 	
 	// Radius of the sphere encasing the particles
 	real_t radius;
@@ -49,23 +49,27 @@ public:
 		}
 	}
 	
-	void updateAttachedParticles(std::vector<Particle<D>>& particles, real_t maximumAllowedDisplacement) override {
-        Particle<D>* particle = &particles[0];
-        if (particle->attached) {
+	void updateAttachedParticles(ParticleStore<D>& particles, real_t maximumAllowedDisplacement) override {
+        if (particles.attached[0]) {
+            Vec<real_t, D> position = particles.getPosition(0);
             if (withOffset) {
                 // move the whole set of particles relative to the first so that the leftmost point on X on the boundary is stuck to the first particle, no matter where it goes
-                Vec<real_t, D> offset = -particle->position;
+                Vec<real_t, D> offset = -position;
                 offset.setX(offset.X() - radius);
                 int numParticles = int(particles.size());
-                #pragma omp parallel for
-                for (int i = 0; i < numParticles; ++i) {
-                    particles[i].position += offset;
+                for (int a = 0; a < D; ++a) {
+                    real_t* axis = particles.position[a].data();
+                    #pragma omp parallel for
+                    for (int i = 0; i < numParticles; ++i) {
+                        axis[i] += offset[a];
+                    }
                 }
             } else {
                 // move the particle towards the leftmost point on X on the boudnary
                 Vec<real_t, D> target = Vec<real_t, D>::Zero();
                 target.setX(-radius);
-                particle->position.moveTowards(target, maximumAllowedDisplacement);
+                position.moveTowards(target, maximumAllowedDisplacement);
+                particles.setPosition(0, position);
             }
         }
 	}
@@ -86,8 +90,8 @@ public:
 		}
 	}
 	
-	inline std::string toJson() override {
-		return "{ 'type': 'sphere', 'radius': " + std::to_string(radius) + ", 'extent': " + std::to_string(extent) + " }";
+	inline void toJson(JsonWriter& json) override {
+		json.beginObject(true).field("type", "sphere").field("radius", radius).field("extent", extent).endObject();
 	}
 	
 	inline void toBinary(bio::BufferedBinaryFileOutput<>& data) override {
@@ -6,7 +6,6 @@
 #include <unordered_set>
 #include "delaunator.h"
 #include "Vec.h"
-#include "Particle.h"
 
 namespace sd {
 
@@ -20,16 +19,18 @@ namespace sd {
 
     /// Creates the delaunay triangulation for the set of particles
     /// Adapted from https://github.com/Fil/d3-geo-voronoi/blob/b391ee46d097f5ce41f80c1a2b8d12e34fd685ea/src/delaunay.js#L45
-    void SphericalDelaunay(const std::vector<Particle<3>>& particles, std::vector<IVec3>& outTriangles, std::vector<std::unordered_set<int>>& outEdges) {
+    /// EdgeSet is the per-vertex neighbour set, which needs clear() and insert()
+    template<typename EdgeSet>
+    void SphericalDelaunay(const std::vector<Vec3>& spherical, std::vector<IVec3>& outTriangles, std::vector<EdgeSet>& outEdges) {
 
-        assert(particles.size() > 1);
+        assert(spherical.size() > 1);
 
         // map particles to stereographic projection (skipping index 0 (= north pole)
-        std::vector<real_t> points(particles.size() * 2 - 2); // x1 y1 x2 y2 etc
-        for (std::size_t i = 1; i < particles.size(); ++i) {
+        std::vector<real_t> points(spherical.size() * 2 - 2); // x1 y1 x2 y2 etc
+        for (std::size_t i = 1; i < spherical.size(); ++i) {
             // From https://en.wikipedia.org/wiki/Stereographic_projection#First_formulation
-            points[i * 2 - 2] = particles[i].spherical.X() / ((real_t)1 - particles[i].spherical.Y());
-            points[i * 2 - 1] = particles[i].spherical.Z() / ((real_t)1 - particles[i].spherical.Y());
+            points[i * 2 - 2] = spherical[i].X() / ((real_t)1 - spherical[i].Y());
+            points[i * 2 - 1] = spherical[i].Z() / ((real_t)1 - spherical[i].Y());
         }
 
         // Run Delaunay triangulation on projected points
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <vector>
+#include <array>
+#include <cmath>
+#include <cassert>
+
+#include "Vec.h"
+#include "MeshConnectivity.h"
+
+namespace sd {
+
+	/// Persistent Delaunay triangulation of points on the unit sphere, updated one point at a time
+	/// Triangles are kept in the caller's triangle list (counter-clockwise seen from outside, as produced by SphericalDelaunay()),
+	/// along with the triangle across each of their edges (see MeshConnectivity), so that new points only touch the triangles around them:
+	/// the triangle containing the new point is found by walking towards it and split in 3, then edges are flipped until all triangles are Delaunay again (Lawson)
+	/// On the sphere, a triangle is Delaunay if no neighbouring point lies above its plane (i.e. within its circumcircle), so this converges to the convex hull of the points,
+	/// which is the same triangulation SphericalDelaunay() computes from scratch
+	/// Flips never remove points, so the triangulation stays valid even where float positions make the Delaunay criterion ambiguous
+	class SphericalTriangulation : public MeshConnectivity {
+
+	protected:
+
+		using DVec3 = Vec<double, 3>;
+
+		/// Scratch space for insert(): triangles whose edge opposite the new point may need flipping
+		std::vector<int> flipStack;
+
+		static inline DVec3 toDouble(const Vec3& v) {
+			return DVec3(double(v.X()), double(v.Y()), double(v.Z()));
+		}
+
+		/// Positive if p lies above the plane of triangle abc (i.e. within its circumcircle on the sphere)
+		static inline double orient(const DVec3& a, const DVec3& b, const DVec3& c, const DVec3& p) {
+			return VecUtils::cross(b - a, c - a).dot(p - a);
+		}
+
+		/// Positive if p lies to the left of the great circle from a to b, seen from outside
+		static inline double side(const DVec3& a, const DVec3& b, const DVec3& p) {
+			return VecUtils::cross(a, b).dot(p);
+		}
+
+		/// Returns a triangle whose spherical triangle contains p, walking from a triangle using the given vertex
+		int locate(const std::vector<Vec3>& spherical, const std::vector<IVec3>& triangles, const DVec3& p, int startVertex) const {
+			int t = vertexTriangles[startVertex];
+			int rotation = 0;
+			for (std::size_t steps = 0; steps < triangles.size(); ++steps) {
+				const IVec3& tri = triangles[t];
+				int next = -1;
+				// try the edges in a different order at each step, so that the walk can't cycle
+				for (int e = 0; e < 3 && next < 0; ++e) {
+					int k = (e + rotation) % 3;
+					if (side(toDouble(spherical[tri[k]]), toDouble(spherical[tri[(k + 1) % 3]]), p) < 0) {
+						next = neighbours[t][k];
+					}
+				}
+				if (next < 0) return t;
+				t = next;
+				++rotation;
+			}
+
+			// walk didn't converge (only possible with near-degenerate triangles): fall back to the triangle p lies the furthest above
+			int best = 0;
+			double bestOrient = -1;
+			for (std::size_t i = 0; i < triangles.size(); ++i) {
+				const IVec3& tri = triangles[i];
+				double o = orient(toDouble(spherical[tri[0]]), toDouble(spherical[tri[1]]), toDouble(spherical[tri[2]]), p);
+				if (o > bestOrient) {
+					bestOrient = o;
+					best = int(i);
+				}
+			}
+			return best;
+		}
+
+	public:
+
+		/// Inserts point p (spherical[p], on the unit sphere and not yet in the triangulation), updating triangles and the edge map in place
+		/// The walk towards p starts at nearVertex if given, or otherwise at the closest out of a few vertices sampled across the triangulation
+		/// EdgeSet is the per-vertex neighbour set, which needs insert() and erase(); edges needs a slot for p already
+		template<typename EdgeSet>
+		void insert(const std::vector<Vec3>& spherical, int p, int nearVertex, std::vector<IVec3>& triangles, std::vector<EdgeSet>& edges) {
+			assert(!empty());
+			DVec3 point = toDouble(spherical[p]);
+			vertexTriangles.resize(spherical.size(), -1);
+
+			// jump & walk: start from the sampled vertex closest to p
+			if (nearVertex < 0) {
+				int samples = int(std::cbrt(double(p))) + 1;
+				double bestDot = -2;
+				for (int s = 0; s < samples; ++s) {
+					int v = int((long long)s * p / samples);
+					double d = toDouble(spherical[v]).dot(point);
+					if (d > bestDot) {
+						bestDot = d;
+						nearVertex = v;
+					}
+				}
+			}
+			int t0 = locate(spherical, triangles, point, nearVertex);
+
+			// split the containing triangle (a, b, c) into (a, b, p), (b, c, p) & (c, a, p)
+			int a = triangles[t0][0], b = triangles[t0][1], c = triangles[t0][2];
+			int nAB = neighbours[t0][0], nBC = neighbours[t0][1], nCA = neighbours[t0][2];
+			int t1 = int(triangles.size()), t2 = t1 + 1;
+			triangles[t0] = IVec3(a, b, p);		neighbours[t0] = { nAB, t1, t2 };
+			triangles.push_back(IVec3(b, c, p));	neighbours.push_back({ nBC, t2, t0 });
+			triangles.push_back(IVec3(c, a, p));	neighbours.push_back({ nCA, t0, t1 });
+			replaceNeighbour(nBC, t0, t1);
+			replaceNeighbour(nCA, t0, t2);
+			vertexTriangles[a] = t0;	vertexTriangles[b] = t1;	vertexTriangles[c] = t2;	vertexTriangles[p] = t0;
+			edges[p].insert(a);	edges[a].insert(p);
+			edges[p].insert(b);	edges[b].insert(p);
+			edges[p].insert(c);	edges[c].insert(p);
+
+			// flip edges opposite p for as long as the point across them lies within the circumcircle
+			// every triangle on the stack is (u, v, p), with the edge to check being u -> v
+			flipStack.clear();
+			flipStack.push_back(t0);
+			flipStack.push_back(t1);
+			flipStack.push_back(t2);
+			std::size_t maxFlips = 4 * triangles.size(); // can only be reached if float rounding makes flips undo each other
+			for (std::size_t flips = 0; !flipStack.empty() && flips < maxFlips; ++flips) {
+				int t = flipStack.back();
+				flipStack.pop_back();
+				int u = triangles[t][0], v = triangles[t][1];
+				int n = neighbours[t][0];
+
+				// n = (v, u, w)
+				rotateTo(n, v, triangles, neighbours);
+				int w = triangles[n][2];
+				if (orient(toDouble(spherical[u]), toDouble(spherical[v]), point, toDouble(spherical[w])) <= 0) continue;
+
+				// flip u-v into w-p: t becomes (u, w, p), n becomes (w, v, p)
+				int tVP = neighbours[t][1], tPU = neighbours[t][2];
+				int nUW = neighbours[n][1], nWV = neighbours[n][2];
+				triangles[t] = IVec3(u, w, p);		neighbours[t] = { nUW, n, tPU };
+				triangles[n] = IVec3(w, v, p);		neighbours[n] = { nWV, tVP, t };
+				replaceNeighbour(nUW, n, t);
+				replaceNeighbour(tVP, t, n);
+				vertexTriangles[u] = t;		vertexTriangles[w] = t;		vertexTriangles[v] = n;
+				edges[u].erase(v);	edges[v].erase(u);
+				edges[w].insert(p);	edges[p].insert(w);
+
+				flipStack.push_back(t);
+				flipStack.push_back(n);
+			}
+		}
+
+	};
+
+}
@@ -7,20 +7,36 @@
 #include <unordered_set>
 #include <memory>
 #include <algorithm>
+#include <type_traits>
 
 #include "Particle.h"
 #include "SphereBoundary.h"
 #include "Grid.h"
+#include "HashGrid.h"
+#include "RepulsionKernel.h"
 #include "Options.h"
 #include "BinaryIO.h"
+#include "DeltaEncoding.h"
+#include "JsonWriter.h"
 #include "Utils.h"
 #include "warnings.h"
 
+#ifdef _OPENMP
+	#include <omp.h>
+#endif
+
 
 WARNING_PUSH;
 WARNING_DISABLE_OMP_PRAGMAS;
 
 
+#ifdef USE_HASH_GRID
+	template<int D> using SpatialGrid = HashGrid<D>;
+#else // USE_HASH_GRID
+	template<int D> using SpatialGrid = Grid<D>;
+#endif // !USE_HASH_GRID
+
+
 template<typename Bytes=bio::BufferedBinaryFileOutput<>>
 class SurfaceBase {
 public:
@@ -29,12 +45,16 @@ public:
     virtual int getDimension() = 0;
 	virtual void addParticle(real_t progression) = 0;
 	virtual void update(real_t progression) = 0;
-	virtual std::string toJson(int runtimeMs) = 0;
-	virtual void toBinary(int runtimeMs, Bytes& data) = 0;
+	virtual void toJson(int runtimeMs, JsonWriter& json) = 0;
+	virtual void toBinary(int runtimeMs, Bytes& data, int version) = 0;
+	virtual void setCompactBinary(real_t quantum, int keyframeInterval) = 0;
 };
 
 
-template<int D, typename neighbour_iterator_t, typename Bytes=bio::BufferedBinaryFileOutput<>>
+/// Base for all surface models, with Derived being the model itself (CRTP)
+/// Topology queries are resolved statically through Derived, so that they can be inlined into the per-pair loops;
+/// SurfaceBase remains the only runtime-polymorphic interface
+template<typename Derived, int D, typename neighbour_iterator_t, typename Bytes=bio::BufferedBinaryFileOutput<>>
 class Surface : public SurfaceBase<Bytes> {
 
 public:
@@ -54,6 +74,8 @@ public:
         real_t rigidity = real_t(0); // 0..1
 		std::shared_ptr<BoundaryCondition<D>> boundary = nullptr;
 		real_t dt = (real_t).15;
+		real_t verletSkin = real_t(0); // if > 0, non-neighbour candidates come from per-particle Verlet lists built with this much extra range, only rebuilt once particles have moved by half of it (only exact while repulsion radii can't exceed the interaction range, see SurfaceFactory)
+		bool halfShell = false; // if true, each pair of particles is only visited once, applying forces to both sides (forces then get summed in a different order)
 
 	};
 
@@ -71,27 +93,66 @@ protected:
 	std::mt19937 rng;
 
 	// List of particles/vertices that make up the surface
-	std::vector<Particle<D>> particles;
+	ParticleStore<D> particles;
+
+	// Per-particle radius within which non-neighbours are repulsed, refreshed once per update
+	std::vector<real_t> repulsionRadii;
+
+	// Per-thread force accumulators for half-shell updates
+	std::vector<real_t> halfShellForces;
+
+	// Volume at the current particle positions, valid while cachedVolumeCurrent - see currentVolume()
+	// This is a cache, not a running total: it is recomputed in full after every step & topology change
+	real_t cachedVolume = 0;
+	bool cachedVolumeCurrent = false;
+
+	// State of the compact binary encoding, carried over from one snapshot to the next - see setCompactBinary()
+	SnapshotEncoder<D> snapshotEncoder;
+
+	// Acceleration kernel specialised for the current parameters, see selectKernels()
+	void (Surface::*accelerationKernel)(real_t pressureAmount) = nullptr;
 
 	// Grid - spatial acceleration data structure
 	#ifdef USE_GRID
-		std::unique_ptr<Grid<D>> grid;
+		std::unique_ptr<SpatialGrid<D>> grid;
+
+		// Verlet lists - per-particle non-neighbour candidates within interaction range + skin of the positions they were last binned at
+		// Only used when params.verletSkin > 0, in which case the grid is only rebuilt along with the lists
+		std::vector<std::vector<int>> verletLists;
+		std::array<std::vector<real_t>, D> verletReference; // verletReference[axis][particle], position at the time of the last (re)build
 	#endif // USE_GRID
 	
 	// Must be implemented - returns the normal vector (pointing outwards) for a given particle
 	virtual void computeNormals() {}
 	virtual Vec<real_t, D> getNormal(int i) = 0;
 
-	// Neighbour interfaces - must be implemented in derived classes
-	virtual bool areNeighbours(int i, int j) = 0;
-	virtual neighbour_iterator_t beginNeighbours(int i) = 0;
-	virtual neighbour_iterator_t endNeighbours(int i) = 0;
+	inline Derived& derived() { return static_cast<Derived&>(*this); }
+
+	// Neighbour interfaces - must be implemented in Derived (hiding these, which would otherwise recurse forever)
+	inline bool areNeighbours(int i, int j) { return derived().areNeighbours(i, j); }
+	inline neighbour_iterator_t beginNeighbours(int i) { return derived().beginNeighbours(i); }
+	inline neighbour_iterator_t endNeighbours(int i) { return derived().endNeighbours(i); }
 
-	// Must be implemented in derived classes - returns a repulsion multiplier for two particles i and j
-	virtual real_t getSurfaceTension(int i, int j) = 0;
+	// Must be implemented in Derived - returns a repulsion multiplier for two particles i and j
+	// Expected to be symmetric, i.e. getSurfaceTension(i, j) == getSurfaceTension(j, i)
+	inline real_t getSurfaceTension(int i, int j) { return derived().getSurfaceTension(i, j); }
 	
 	// Must be implemented in derived classes; returns the full volume/area of the surface
 	virtual real_t getVolume() = 0;
+
+	// Returns the volume at the current particle positions, only calling getVolume() if it isn't known already
+	real_t currentVolume() {
+		if (!cachedVolumeCurrent) {
+			cachedVolume = getVolume();
+			cachedVolumeCurrent = true;
+		}
+		return cachedVolume;
+	}
+
+	// To be called by Derived after a topology change, so that the volume gets recomputed on next use
+	inline void invalidateVolume() {
+		cachedVolumeCurrent = false;
+	}
 	
 	// Must be implemented in derived classes; returns a hint to indicate the type of surface this is, which will be inserted in output files
 	virtual std::string getTypeHint() = 0;
@@ -107,8 +168,9 @@ protected:
         real_t totalDistance = real_t(0.0);
         neighbour_iterator_t begin = beginNeighbours(i);
         neighbour_iterator_t end = endNeighbours(i);
+        Vec<real_t, D> position = particles.getPosition(i);
         for (auto it = begin; it != end; it++) {
-			Vec<real_t, D> towards = particles[*it].position - particles[i].position;
+			Vec<real_t, D> towards = particles.getPosition(*it) - position;
             totalDistance += std::sqrt(towards.lengthSqr());
             ++neighbourCount;
         }
@@ -124,8 +186,9 @@ protected:
         real_t maxDistance = real_t(0.0);
         neighbour_iterator_t begin = beginNeighbours(i);
         neighbour_iterator_t end = endNeighbours(i);
+        Vec<real_t, D> position = particles.getPosition(i);
         for (auto it = begin; it != end; it++) {
-            Vec<real_t, D> towards = particles[*it].position - particles[i].position;
+            Vec<real_t, D> towards = particles.getPosition(*it) - position;
             real_t distance = std::sqrt(towards.lengthSqr());
             if (distance > maxDistance) {
                 maxDistance = distance;
@@ -134,19 +197,52 @@ protected:
         return maxDistance;
     }
     
+    // Returns the radius within which particle i repulses non-neighbours, before any pairwise surface tension multiplier
+    inline real_t getRepulsionRadius(int i) {
+        return params.repelByMaxNeighbourDist ?
+            std::max(getMaxNeighbourDist(i), params.attractionMagnitude * params.repulsionMagnitudeFactor)
+        :
+            params.attractionMagnitude * params.repulsionMagnitudeFactor * getRepulsion(i);
+    }
+    
+    // Returns the acceleration of particle i before any particle-particle forces: damped previous acceleration, boundary restriction & pressure
+    // Boundary is the concrete type of params.boundary (void without one), Pressure whether params.pressure is non-zero
+    template<typename Boundary, bool Pressure>
+    inline Vec<real_t, D> getBaseAcceleration(int i, const Vec<real_t, D>& position, real_t pressureAmount) {
+		Vec<real_t, D> acceleration = particles.getAcceleration(i);
+
+		// dampen acceleration
+		acceleration *= params.damping * params.damping;
+
+		// boundary restriction force
+		if constexpr (!std::is_void<Boundary>::value) {
+			acceleration += static_cast<Boundary*>(params.boundary.get())->force(position);
+		}
+
+		// pressure force
+		if (Pressure && pressureAmount != 0) {
+			Vec<real_t, D> normal = getNormal(i);
+			normal *= pressureAmount;
+			acceleration += normal;
+		}
+
+		return acceleration;
+    }
+
     // Returns an estimate of the density locally around particle i
     // Counts the number of particles within circle of radius attraction magnitude
     int getNearbyParticleCount (int i) {
         int total = 0;
+        Vec<real_t, D> position = particles.getPosition(i);
     #ifdef USE_GRID
-		std::array<std::vector<int>*, powConstexpr(3, D)> cells;
-		grid->sample(particles[i].position, cells);
-		for (const std::vector<int>* const cell : cells) if (cell) for (const int& j : *cell) {
+		std::array<CellRange, powConstexpr(3, D)> cells;
+		grid->sample(position, cells);
+		for (const CellRange& cell : cells) for (const int& j : cell) {
 	#else // USE_GRID
 		for (std::size_t j = 0; j < particles.size(); ++j) {
 	#endif // !USE_GRID
 			if (i == j) continue; // same particle
-            Vec<real_t, D> towards = particles[j].position - particles[i].position;
+            Vec<real_t, D> towards = particles.getPosition(j) - position;
             if (towards.lengthSqr() < params.attractionMagnitude * params.attractionMagnitude) {
                 ++total;
             }
@@ -165,54 +261,212 @@ public:
 
 	void update (real_t progression) override;
 
-	/// Export to JSON, to be loaded into WebGL viewer
-	std::string toJson(int runtimeMs) final override;
-	virtual void specificJson(std::string& json) = 0;
+	/// Specialises the acceleration kernel for the current parameters, given the concrete type of params.boundary (void if there is none)
+	/// Boundary may be BoundaryCondition<D> itself, in which case boundary forces go through virtual calls - that's what surfaces start out with
+	template<typename Boundary>
+	void selectKernels() {
+		if constexpr (std::is_void<Boundary>::value) {
+			if (params.boundary) {
+				std::printf("Error: boundary condition given, but acceleration kernel selected without one!");
+				std::exit(1);
+			}
+		} else if (!dynamic_cast<Boundary*>(params.boundary.get())) {
+			std::printf("Error: acceleration kernel selected for a different boundary condition!");
+			std::exit(1);
+		}
+		bool anisotropic = params.repulsionAnisotropy != real_t(1); // any component other than 1
+		selectKernel<Boundary>(params.halfShell, params.repelByMaxNeighbourDist, params.pressure != 0, anisotropic);
+	}
+
+	/// Export to JSON, to be loaded into WebGL viewer, as an object written to json
+	void toJson(int runtimeMs, JsonWriter& json) final override;
+	/// Writes the particle data as members of the object being written to json
+	virtual void specificJson(JsonWriter& json) = 0;
 
-	/// Export to minimal binary format
+	/// Export to minimal binary format, as a frame of the given file version (5, or 6 for columnar particle data)
 	/// Data may not be empty, in which case the surface info will be appended to the data vector, leaving existing contents as-is
-	void toBinary(int runtimeMs, Bytes& data) final override;
-	virtual void specificBinary(Bytes& data) = 0;
+	void toBinary(int runtimeMs, Bytes& data, int version) final override;
+	/// Writes the particle data of the frame; with version 6, as a column count (u32) followed by that many columns (see bio::writeColumn),
+	/// encoded through snapshotEncoder if compact binary output is on
+	virtual void specificBinary(Bytes& data, int version) = 0;
+
+	/// Turns on compact encoding of version 6 frames (see SnapshotEncoder), with positions rounded to multiples of quantum
+	inline void setCompactBinary(real_t quantum, int keyframeInterval) final override {
+		snapshotEncoder.enable(quantum, keyframeInterval);
+	}
+
+	/// Read-only access to the particles, e.g. to compare runs in tests
+	inline const ParticleStore<D>& getParticles() const { return particles; }
 
 protected:
 
+	/// Computes the accelerations of all particles, visiting each pair from both sides
+	template<typename Boundary, bool RepelByMaxNeighbourDist, bool Pressure, bool Anisotropic>
+	void updateAccelerations(real_t pressureAmount);
+
+	/// Computes the accelerations of all particles, visiting each pair only once (see Params::halfShell)
+	template<typename Boundary, bool RepelByMaxNeighbourDist, bool Pressure, bool Anisotropic>
+	void updateAccelerationsHalfShell(real_t pressureAmount);
+
+	/// Picks the kernel instantiation matching the runtime switches, one switch at a time (halfShell, repelByMaxNeighbourDist, pressure, anisotropy)
+	template<typename Boundary, bool... Switches, typename... Rest>
+	inline void selectKernel(bool flag, Rest... rest) {
+		if (flag) {
+			selectKernel<Boundary, Switches..., true>(rest...);
+		} else {
+			selectKernel<Boundary, Switches..., false>(rest...);
+		}
+	}
+
+	template<typename Boundary, bool HalfShell, bool RepelByMaxNeighbourDist, bool Pressure, bool Anisotropic>
+	inline void selectKernel() {
+		if constexpr (HalfShell) {
+			accelerationKernel = &Surface::template updateAccelerationsHalfShell<Boundary, RepelByMaxNeighbourDist, Pressure, Anisotropic>;
+		} else {
+			accelerationKernel = &Surface::template updateAccelerations<Boundary, RepelByMaxNeighbourDist, Pressure, Anisotropic>;
+		}
+	}
+
 	inline real_t rand01() { return real_t(std::abs(int(rng())) % 10000) / (real_t)10000; }
 	
 
 	/// Should be called whenever a new particle is added
 	inline void addParticleToGrid(int particle) {
 		#ifdef USE_GRID
-			particles[particle].position.clamp(real_t(-0.5), (real_t)0.4999);
-			grid->add(particles[particle].position, particle);
+			Vec<real_t, D> position = clampToGrid(particle);
+			grid->add(position, particle);
+			if (params.verletSkin > 0) {
+				addParticleToVerletLists(particle);
+			}
 		#endif // USE_GRID
 	}
 
+	/// Renumbers the particles so that particle order[i] becomes particle i (order being a permutation of all particles), rebuilding the grid to match
+	/// Derived classes are left to remap their own per-particle data & indices
+	void reorderParticles(const std::vector<int>& order) {
+		particles.permute(order);
+		#ifdef USE_GRID
+			if (params.verletSkin > 0) {
+				rebuildVerletLists();
+			} else {
+				grid->build(particles.position, (int)particles.size());
+			}
+		#endif // USE_GRID
+	}
+
+#ifdef USE_GRID
+	/// Keeps a particle within the bounds covered by the grid, returning its resulting position
+	inline Vec<real_t, D> clampToGrid(int particle) {
+		Vec<real_t, D> position = particles.getPosition(particle);
+	#ifndef USE_HASH_GRID // hashed grid covers all of space
+		position.clamp(real_t(-0.5), (real_t)0.4999);
+		particles.setPosition(particle, position);
+	#endif // !USE_HASH_GRID
+		return position;
+	}
+
+	/// Distance beyond which non-neighbours are never considered for repulsion, i.e. the grid's cell size without any Verlet skin
+	inline real_t getInteractionRange() const {
+		return params.attractionMagnitude * std::max((real_t)1.0, params.repulsionMagnitudeFactor);
+	}
+
+	/// Fills in the Verlet list for particle i from the grid, using reference positions for all distances
+	void buildVerletList(int i, std::vector<int>& list) {
+		real_t range = getInteractionRange() + params.verletSkin;
+		Vec<real_t, D> reference;
+		for (int a = 0; a < D; ++a) reference.set(a, verletReference[a][i]);
+		list.clear();
+		std::array<CellRange, powConstexpr(3, D)> cells;
+		grid->sample(reference, cells);
+		for (const CellRange& cell : cells) for (const int& j : cell) {
+			if (i == j) continue;
+			real_t d2 = 0;
+			for (int a = 0; a < D; ++a) d2 += (verletReference[a][j] - reference[a]) * (verletReference[a][j] - reference[a]);
+			if (d2 < range * range) list.push_back(j);
+		}
+	}
+
+	/// Inserts a newly added particle (already in the grid) into the Verlet lists, without rebuilding the lists of other particles
+	void addParticleToVerletLists(int particle) {
+		for (int a = 0; a < D; ++a) {
+			verletReference[a].resize(particles.size());
+			verletReference[a][particle] = particles.position[a][particle];
+		}
+		verletLists.resize(particles.size());
+		buildVerletList(particle, verletLists[particle]);
+		for (int j : verletLists[particle]) {
+			verletLists[j].push_back(particle);
+		}
+	}
+
+	/// Rebuilds the grid and all Verlet lists from the current positions, if any particle has moved by more than half the skin since the last rebuild
+	/// (past that point, two particles may have come within interaction range of each other without being in each other's lists)
+	void updateVerletLists() {
+		int numParticles = (int)particles.size();
+		real_t maxDisplacementSqr = 0;
+		#pragma omp parallel for reduction(max: maxDisplacementSqr)
+		for (int i = 0; i < numParticles; ++i) {
+			real_t d2 = 0;
+			for (int a = 0; a < D; ++a) d2 += (particles.position[a][i] - verletReference[a][i]) * (particles.position[a][i] - verletReference[a][i]);
+			maxDisplacementSqr = std::max(maxDisplacementSqr, d2);
+		}
+		real_t halfSkin = params.verletSkin * real_t(.5);
+		if (maxDisplacementSqr <= halfSkin * halfSkin) return;
+		rebuildVerletLists();
+	}
+
+	/// Rebuilds the grid and all Verlet lists from the current positions
+	void rebuildVerletLists() {
+		int numParticles = (int)particles.size();
+		#pragma omp parallel for
+		for (int i = 0; i < numParticles; ++i) {
+			clampToGrid(i);
+		}
+		grid->build(particles.position, numParticles);
+		for (int a = 0; a < D; ++a) {
+			verletReference[a] = particles.position[a];
+		}
+		verletLists.resize(numParticles);
+		#pragma omp parallel for schedule(dynamic, 64)
+		for (int i = 0; i < numParticles; ++i) {
+			buildVerletList(i, verletLists[i]);
+		}
+	}
+#endif // USE_GRID
+
 };
 
 
 
-template<int D, typename neighbour_iterator_t, typename Bytes>
-Surface<D, neighbour_iterator_t, Bytes>::Surface(Surface<D, neighbour_iterator_t, Bytes>::Params params, int seed) :
+template<typename Derived, int D, typename neighbour_iterator_t, typename Bytes>
+Surface<Derived, D, neighbour_iterator_t, Bytes>::Surface(Surface<Derived, D, neighbour_iterator_t, Bytes>::Params params, int seed) :
 		params(params),
 		seed(seed),
 		rng(std::mt19937(seed)) {
 	
-	// create grid
+	// create grid (cells are widened by the skin in Verlet list mode, so that lists can be built from the 3^D neighbouring cells)
 #ifdef USE_GRID
-	grid = std::make_unique<Grid<D>>(real_t(params.attractionMagnitude * std::max((real_t)1.0, params.repulsionMagnitudeFactor)));
+	grid = std::make_unique<SpatialGrid<D>>(getInteractionRange() + std::max(real_t(0), params.verletSkin));
 #endif // USE_GRID
+
+	// generic boundary handling until SurfaceFactory specialises the kernel for the actual boundary type
+	if (params.boundary) {
+		selectKernels<BoundaryCondition<D>>();
+	} else {
+		selectKernels<void>();
+	}
 }
 
 
-template<int D, typename neighbour_iterator_t, typename Bytes>
-void Surface<D, neighbour_iterator_t, Bytes>::update(real_t progression) {
+template<typename Derived, int D, typename neighbour_iterator_t, typename Bytes>
+void Surface<Derived, D, neighbour_iterator_t, Bytes>::update(real_t progression) {
 
 	int numParticles = (int)particles.size();
 	
 	// compute volume delta since beginning and resulting pressure force magnitude to apply to each particle
 	bool boundaryNeedsVolume = !params.boundary ? false : params.boundary->needsVolume();
-	real_t volume = params.pressure == 0 && !boundaryNeedsVolume ? 1 : // no need to compute volume without a pressure force or volume-based boundary growth
-						std::max(real_t(0), getVolume());
+	bool needsVolume = params.pressure != 0 || boundaryNeedsVolume; // no need to compute volume without a pressure force or volume-based boundary growth
+	real_t volume = needsVolume ? std::max(real_t(0), currentVolume()) : 1;
 	if (params.targetVolume < 0) params.targetVolume = volume;
     real_t actualTargetVolume = (params.finalTargetVolume * params.targetVolume) * progression + params.targetVolume * (real_t(1) - progression); // lerp from original volume to final target volume * original volume
 	real_t pressureAmount = actualTargetVolume == 0 ? 0 : params.pressure * (actualTargetVolume - volume) / actualTargetVolume; // increased volume: negative pressure; decreased volume: positive pressure
@@ -223,7 +477,7 @@ void Surface<D, neighbour_iterator_t, Bytes>::update(real_t progression) {
 #ifndef NDEBUG
     #pragma omp parallel for
     for (int i = 1; i < numParticles; ++i) {
-        if (particles[i].attached) {
+        if (particles.attached[i]) {
             printf("Particle %d is attached to the boundary - ONLY particle 0 should currently be attached, otherwise updateAttachedParticles implementations need to be updated!", i);
             exit(1);
         }
@@ -235,53 +489,143 @@ void Surface<D, neighbour_iterator_t, Bytes>::update(real_t progression) {
         params.boundary->updateAttachedParticles(particles, params.attractionMagnitude * std::max((real_t)1.0, params.repulsionMagnitudeFactor));
     }
 
+#ifdef USE_GRID
+	// attached particles may have been moved past the skin
+	if (params.verletSkin > 0 && params.boundary) {
+		updateVerletLists();
+	}
+#endif // USE_GRID
+
+	// repulsion radii only depend on positions & topology, neither of which change until the integration pass below
+	// so compute them once per particle rather than once per pair
+	repulsionRadii.resize(numParticles);
+	#pragma omp parallel for
+	for (int i = 0; i < numParticles; ++i) {
+		repulsionRadii[i] = getRepulsionRadius(i);
+	}
+
 	// update acceleration values for all particles first without writing to position
+	(this->*accelerationKernel)(pressureAmount);
+
+	// update positions for all particles, one axis at a time so that each pass streams through contiguous arrays
+	const std::uint8_t* attached = particles.attached.data();
+	const real_t* flexibility = particles.flexibility.data();
+	#pragma omp parallel
+	for (int a = 0; a < D; ++a) {
+		const real_t* acceleration = particles.acceleration[a].data();
+		real_t* velocity = particles.velocity[a].data();
+		real_t* position = particles.position[a].data();
+		#pragma omp for
+		for (int i = 0; i < numParticles; ++i) {
+
+			// dampen velocity & apply acceleration (particles fixed in place are left as-is)
+			real_t v = velocity[i] * params.damping + acceleration[i] * params.dt;
+			velocity[i] = attached[i] ? velocity[i] : v;
+
+			// apply velocity
+			position[i] += attached[i] ? real_t(0) : velocity[i] * params.dt * flexibility[i];
+		}
+	}
+
+	// apply hard boundary
+	if (params.boundary) {
+		#pragma omp parallel for
+		for (int i = 0; i < numParticles; ++i) {
+			if (particles.attached[i]) continue;
+			Vec<real_t, D> position = particles.getPosition(i);
+			params.boundary->hard(position);
+			particles.setPosition(i, position);
+		}
+	}
+
+	#pragma omp parallel for
+	for (int i = 0; i < numParticles; ++i) {
+		if (particles.attached[i]) continue;
+        particles.flexibility[i] *= (real_t(1.0) - params.rigidity);
+        if (particles.flexibility[i] < real_t(0)) {
+            particles.flexibility[i] = real_t(0);
+        }
+	}
+
+	// Update grid
+	#ifdef USE_GRID
+		// positions need to be kept within the grid every step, but with Verlet lists, cells & lists only need rebuilding once particles have moved far enough
+		#pragma omp parallel for
+		for (int i = 0; i < numParticles; ++i) {
+			clampToGrid(i);
+		}
+		if (params.verletSkin > 0) {
+			updateVerletLists();
+		} else {
+			grid->build(particles.position, numParticles);
+		}
+	#endif
+
+	// the volume computed at the start of the step no longer holds after particles moved
+	invalidateVolume();
+
+	// Update boundary condition
+	if (params.boundary) {
+		params.boundary->update(volume);
+	}
+
+	++t;
+}
+
+
+template<typename Derived, int D, typename neighbour_iterator_t, typename Bytes>
+template<typename Boundary, bool RepelByMaxNeighbourDist, bool Pressure, bool Anisotropic>
+void Surface<Derived, D, neighbour_iterator_t, Bytes>::updateAccelerations(real_t pressureAmount) {
+
+	int numParticles = (int)particles.size();
+	real_t anisotropy[D];
+	for (int a = 0; a < D; ++a) anisotropy[a] = params.repulsionAnisotropy[a];
+
 	#pragma omp parallel for
 	for (int i = 0; i < numParticles; ++i) {
         
         // attached & fully rigid particles should no longer move at all
-        if (particles[i].attached || particles[i].flexibility <= 0.0) {
+        if (particles.attached[i] || particles.flexibility[i] <= 0.0) {
             continue;
         }
 
-		// dampen acceleration
-		particles[i].acceleration *= params.damping * params.damping;
-
-		// boundary restriction force
-		if (params.boundary) {
-			particles[i].acceleration += params.boundary->force(particles[i].position);
-		}
-		
-		// pressure force
-		if (pressureAmount != 0) {
-			Vec<real_t, D> normal = getNormal(i);
-			normal *= pressureAmount;
-			particles[i].acceleration += normal;
-		}
+		// accumulate locally, only writing back to the store once all forces have been summed
+		Vec<real_t, D> position = particles.getPosition(i);
+		Vec<real_t, D> acceleration = getBaseAcceleration<Boundary, Pressure>(i, position, pressureAmount);
 		
-		// iterate over non-neighbour particles
+		// iterate over non-neighbour particles, gathering candidates into lanes that get evaluated all at once
+		RepulsionLanes<D> lanes;
+		auto flushLanes = [&]() {
+			if constexpr (Anisotropic) {
+				lanes.evaluate(anisotropy);
+			} else {
+				lanes.evaluate();
+			}
+			for (int k = 0; k < lanes.count; ++k) {
+				for (int a = 0; a < D; ++a) acceleration.set(a, acceleration[a] + lanes.towards[a][k]);
+			}
+			lanes.count = 0;
+		};
+		auto addCandidate = [&](int j) {
+			if (i == j || areNeighbours(i, j)) return; // same particle, or nearest neighbours (topology can change between Verlet list rebuilds)
+
+			// repel if close enough (masked out by the kernel otherwise)
+			for (int a = 0; a < D; ++a) lanes.towards[a][lanes.count] = particles.position[a][j] - position[a];
+			lanes.radius[lanes.count] = RepelByMaxNeighbourDist ? repulsionRadii[j] : repulsionRadii[j] * getSurfaceTension(i, j);
+			if (++lanes.count == RepulsionLanes<D>::Width) flushLanes();
+		};
 	#ifdef USE_GRID
-		std::array<std::vector<int>*, powConstexpr(3, D)> cells;
-		grid->sample(particles[i].position, cells);
-		for (const std::vector<int>* const cell : cells) if (cell) for (const int& j : *cell) {
+		if (params.verletSkin > 0) {
+			for (const int& j : verletLists[i]) addCandidate(j);
+		} else {
+			std::array<CellRange, powConstexpr(3, D)> cells;
+			grid->sample(position, cells);
+			for (const CellRange& cell : cells) for (const int& j : cell) addCandidate(j);
+		}
 	#else // USE_GRID
-		for (std::size_t j = 0; j < particles.size(); ++j) {
+		for (int j = 0; j < numParticles; ++j) addCandidate(j);
 	#endif // !USE_GRID
-			if (i == j || areNeighbours(i, j)) continue; // same particle, or nearest neighbours
-
-			// repel if close enough
-			Vec<real_t, D> towards = particles[j].position - particles[i].position;
-			real_t repulsionLen = params.repelByMaxNeighbourDist ?
-                std::max(getMaxNeighbourDist(j), params.attractionMagnitude * params.repulsionMagnitudeFactor)
-            :
-                params.attractionMagnitude * params.repulsionMagnitudeFactor * getSurfaceTension(i, j) * getRepulsion(j);
-			real_t d2 = towards.lengthSqr(); // d^2 to skip sqrt most of the time
-			if (d2 < repulsionLen * repulsionLen) {
-				towards.normalize();
-				towards *= std::sqrt(d2) - repulsionLen;
-				particles[i].acceleration += towards.hadamard(params.repulsionAnisotropy);
-			}
-		}
+		if (lanes.count > 0) flushLanes();
 
 		// iterate over neighbour particles
 		neighbour_iterator_t neighboursBegin = beginNeighbours(i);
@@ -290,92 +634,171 @@ void Surface<D, neighbour_iterator_t, Bytes>::update(real_t progression) {
 			int neighbour = *it;
 
 			// attract if far, repel if too close
-			Vec<real_t, D> towards = particles[neighbour].position - particles[i].position;
+			Vec<real_t, D> towards = particles.getPosition(neighbour) - position;
 			real_t d = std::sqrt(towards.lengthSqr());
 			towards.normalize();
 			towards *= d - params.attractionMagnitude;
-			particles[i].acceleration += towards;
+			acceleration += towards;
 		}
+
+		particles.setAcceleration(i, acceleration);
 	}
+}
 
-	// update positions for all particles
-	#pragma omp parallel for
-	for (int i = 0; i < numParticles; ++i) {
 
-		// Ignore particles fixed in place
-		if (particles[i].attached) continue;
+template<typename Derived, int D, typename neighbour_iterator_t, typename Bytes>
+template<typename Boundary, bool RepelByMaxNeighbourDist, bool Pressure, bool Anisotropic>
+void Surface<Derived, D, neighbour_iterator_t, Bytes>::updateAccelerationsHalfShell(real_t pressureAmount) {
 
-		// dampen velocity
-		particles[i].velocity *= params.damping;
+	int numParticles = (int)particles.size();
+	const std::uint8_t* attached = particles.attached.data();
+	const real_t* flexibility = particles.flexibility.data();
+
+	// pair forces are accumulated into one buffer per thread (halfShellForces[thread][axis][particle]), and only summed once all pairs have been visited
+	// buffers are allotted for as many threads as may run, but only those of the threads actually started get zeroed and summed
+	int maxThreads = 1;
+#ifdef _OPENMP
+	maxThreads = omp_get_max_threads();
+#endif
+	std::size_t bufferSize = std::size_t(D) * numParticles;
+	halfShellForces.resize(maxThreads * bufferSize);
+	int threads = 1;
+
+	#pragma omp parallel num_threads(maxThreads)
+	{
+		int thread = 0;
+	#ifdef _OPENMP
+		thread = omp_get_thread_num();
+	#endif
+		real_t* forces = halfShellForces.data() + thread * bufferSize;
+		std::fill(forces, forces + bufferSize, real_t(0));
+		// the barrier at the end of single also ensures all buffers are zeroed before any pair is visited
+	#ifdef _OPENMP
+		#pragma omp single
+		threads = omp_get_num_threads();
+	#endif
 
-		// apply acceleration
-		particles[i].velocity += particles[i].acceleration * params.dt;
+		#pragma omp for schedule(dynamic, 64)
+		for (int i = 0; i < numParticles; ++i) {
 
-		// apply velocity
-		particles[i].position += particles[i].velocity * params.dt * particles[i].flexibility;
+			// attached & fully rigid particles should no longer move at all, but still push/pull on the other side of their pairs
+			bool iMoves = !attached[i] && flexibility[i] > 0.0;
+			Vec<real_t, D> position = particles.getPosition(i);
+			Vec<real_t, D> acceleration = Vec<real_t, D>::Zero();
+
+			// repulsion between i and a non-neighbour j, in both directions at once
+			// (surface tension is symmetric, but the repulsion radius of each particle only applies to the other one)
+			auto visitPair = [&](int j) {
+				if (areNeighbours(i, j)) return; // nearest neighbours (topology can change between Verlet list rebuilds)
+
+				Vec<real_t, D> towards = particles.getPosition(j) - position;
+				real_t d2 = towards.lengthSqr();
+				real_t tension = RepelByMaxNeighbourDist ? real_t(1) : getSurfaceTension(i, j);
+				real_t radiusOnI = repulsionRadii[j] * tension;
+				real_t radiusOnJ = repulsionRadii[i] * tension;
+				bool repelI = iMoves && d2 < radiusOnI * radiusOnI;
+				bool repelJ = !attached[j] && flexibility[j] > 0.0 && d2 < radiusOnJ * radiusOnJ;
+				if (!repelI && !repelJ) return;
+
+				real_t d = std::sqrt(d2);
+				towards.normalize();
+				if (repelI) {
+					Vec<real_t, D> force = towards * (d - radiusOnI);
+					if constexpr (Anisotropic) force = force.hadamard(params.repulsionAnisotropy);
+					acceleration += force;
+				}
+				if (repelJ) {
+					Vec<real_t, D> force = towards * real_t(-1) * (d - radiusOnJ);
+					if constexpr (Anisotropic) force = force.hadamard(params.repulsionAnisotropy);
+					for (int a = 0; a < D; ++a) forces[a * numParticles + j] += force[a];
+				}
+			};
+		#ifdef USE_GRID
+			if (params.verletSkin > 0) {
+				for (const int& j : verletLists[i]) if (j > i) visitPair(j);
+			} else {
+				std::array<CellRange, halfStencilSize<D>()> cells;
+				grid->sampleHalf(position, cells);
+				for (const int& j : cells[0]) if (j > i) visitPair(j);
+				for (int c = 1; c < halfStencilSize<D>(); ++c) for (const int& j : cells[c]) visitPair(j);
+			}
+		#else // USE_GRID
+			for (int j = i + 1; j < numParticles; ++j) visitPair(j);
+		#endif // !USE_GRID
+
+			// attraction along each edge, visited from its lower end only
+			neighbour_iterator_t neighboursBegin = beginNeighbours(i);
+			neighbour_iterator_t neighboursEnd = endNeighbours(i);
+			for (auto it = neighboursBegin; it != neighboursEnd; it++) {
+				int neighbour = *it;
+				if (neighbour < i) continue;
+
+				// attract if far, repel if too close
+				Vec<real_t, D> towards = particles.getPosition(neighbour) - position;
+				real_t d = std::sqrt(towards.lengthSqr());
+				towards.normalize();
+				towards *= d - params.attractionMagnitude;
+				acceleration += towards;
+				if (!attached[neighbour] && flexibility[neighbour] > 0.0) {
+					for (int a = 0; a < D; ++a) forces[a * numParticles + neighbour] -= towards[a];
+				}
+			}
 
-		// apply hard boundary
-		if (params.boundary) {
-			params.boundary->hard(particles[i].position);
+			if (iMoves) {
+				for (int a = 0; a < D; ++a) forces[a * numParticles + i] += acceleration[a];
+			}
 		}
-        
-        particles[i].flexibility *= (real_t(1.0) - params.rigidity);
-        if (particles[i].flexibility < real_t(0)) {
-            particles[i].flexibility = real_t(0);
-        }
-	}
 
-	// Update grid
-	#ifdef USE_GRID
-		grid->clear();
+		// sum up the per-thread buffers on top of the damping, boundary & pressure forces
+		#pragma omp for
 		for (int i = 0; i < numParticles; ++i) {
-			addParticleToGrid(i);
+			if (attached[i] || flexibility[i] <= 0.0) continue;
+			Vec<real_t, D> acceleration = getBaseAcceleration<Boundary, Pressure>(i, particles.getPosition(i), pressureAmount);
+			for (int buffer = 0; buffer < threads; ++buffer) {
+				const real_t* threadForces = halfShellForces.data() + buffer * bufferSize;
+				for (int a = 0; a < D; ++a) acceleration.set(a, acceleration[a] + threadForces[a * numParticles + i]);
+			}
+			particles.setAcceleration(i, acceleration);
 		}
-	#endif
-
-	// Update boundary condition
-	if (params.boundary) {
-		params.boundary->update(volume);
 	}
-
-	++t;
 }
 
 
-template<int D, typename neighbour_iterator_t, typename Bytes>
-std::string Surface<D, neighbour_iterator_t, Bytes>::toJson(int runtimeMs) {
-
-	std::string json = "{\n"
-		"\t'date': " + std::to_string(time(nullptr)) + ",\n"
-		"\t'machine': '" + getMachineName() + "',\n"
-		"\t'seed': " + std::to_string(seed) + ",\n"
-		"\t'dimension': " + std::to_string(D) + ",\n"
-		"\t'hint': " + getTypeHint() + ",\n"
-		"\t'timesteps': " + std::to_string(t) + ",\n"
-		"\t'attractionMagnitude': " + std::to_string(params.attractionMagnitude) + ",\n"
-		"\t'repulsionMagnitudeFactor': " + std::to_string(params.repulsionMagnitudeFactor) + ",\n"
-		"\t'damping': " + std::to_string(params.damping) + ",\n"
-		"\t'noise': 0,\n"
-		"\t'repulsionAnisotropy': " + params.repulsionAnisotropy.toString() + ",\n"
-		"\t'boundary': " + (params.boundary ? params.boundary->toJson() : "null") + ",\n"
-		"\t'dt': " + std::to_string(params.dt) + ",\n"
-		"\t'runtime': " + std::to_string(runtimeMs) + ",\n"
-		"\t'volume': " + std::to_string(getVolume()) + ",\n";
+template<typename Derived, int D, typename neighbour_iterator_t, typename Bytes>
+void Surface<Derived, D, neighbour_iterator_t, Bytes>::toJson(int runtimeMs, JsonWriter& json) {
+
+	json.beginObject()
+		.field("date", (long long)time(nullptr))
+		.field("machine", getMachineName())
+		.field("seed", seed)
+		.field("dimension", D)
+		.field("hint", getTypeHint())
+		.field("timesteps", t)
+		.field("attractionMagnitude", params.attractionMagnitude)
+		.field("repulsionMagnitudeFactor", params.repulsionMagnitudeFactor)
+		.field("damping", params.damping)
+		.field("noise", 0)
+		.field("repulsionAnisotropy", params.repulsionAnisotropy)
+		.key("boundary");
+	if (params.boundary) params.boundary->toJson(json);
+	else json.null();
+	json.field("dt", params.dt)
+		.field("runtime", runtimeMs)
+		.field("volume", currentVolume());
 
 	specificJson(json);
 
-	std::replace(json.begin(), json.end(), '\'', '"');
-	return json + "}";
+	json.endObject();
 }
 
-template<int D, typename neighbour_iterator_t, typename Bytes>
-void Surface<D, neighbour_iterator_t, Bytes>::toBinary(int runtimeMs, Bytes& data) {
+template<typename Derived, int D, typename neighbour_iterator_t, typename Bytes>
+void Surface<Derived, D, neighbour_iterator_t, Bytes>::toBinary(int runtimeMs, Bytes& data, int version) {
 
 	// Header, in front of any surface object in the binary file
 	data.push_back('S'); data.push_back('E'); data.push_back('L');
 	
 	// File version
-	bio::writeSimple<std::uint8_t>(data, 5);
+	bio::writeSimple<std::uint8_t>(data, std::uint8_t(version));
 	
 	// Metadata
 	bio::writeSimple<std::uint8_t>(data, D);
@@ -391,7 +814,7 @@ void Surface<D, neighbour_iterator_t, Bytes>::toBinary(int runtimeMs, Bytes& dat
 	bio::writeVec(data, params.repulsionAnisotropy);
 	bio::writeSimple<real_t>(data, params.dt);
 	bio::writeSimple<std::int32_t>(data, runtimeMs);
-	bio::writeSimple<real_t>(data, getVolume());
+	bio::writeSimple<real_t>(data, currentVolume());
 	
 	// Boundary
 	if (params.boundary) {
@@ -403,7 +826,7 @@ void Surface<D, neighbour_iterator_t, Bytes>::toBinary(int runtimeMs, Bytes& dat
 
 	// Core data
 	bio::writeSimple<std::int32_t>(data, (std::int32_t)particles.size());
-	specificBinary(data);
+	specificBinary(data, version);
 
 	// EOS
 	data.push_back(0);
@@ -5,7 +5,7 @@
 #define M_PI 3.14159265358979323846
 #endif
 
-Surface2::Surface2(Params params, SpecificParams specificParams, int seed) : Surface<2, std::array<int, 2>::const_iterator>(params, seed), specificParams(specificParams) {
+Surface2::Surface2(Params params, SpecificParams specificParams, int seed) : Base(params, seed), specificParams(specificParams) {
 	
 	// build initial regular n-gon with side length = attraction magnitude
 	int n = specificParams.initialParticleCount;
@@ -19,7 +19,7 @@ Surface2::Surface2(Params params, SpecificParams specificParams, int seed) : Sur
 	}
 	
 	if (specificParams.attachFirstParticle && params.boundary) {
-		particles.front().attached = true;
+		particles.attached[0] = 1;
 	}
 }
 
@@ -31,39 +31,79 @@ void Surface2::addParticle(real_t) {
 
 	// insert new particle
 	int c = (int)particles.size();
-	particles.push_back(Particle<2>::FromPosition((particles[a].position + particles[b].position) * 0.5));
+	particles.push_back(Particle<2>::FromPosition((particles.getPosition(a) + particles.getPosition(b)) * 0.5));
 	neighbourIndices.push_back({ a, b });
 
 	// update neighbour indices
 	neighbourIndices[a][1] = c;
 	neighbourIndices[b][0] = c;
+	invalidateVolume();
 
 	addParticleToGrid(c);
+
+	// new particles are appended, far away in memory from their neighbours along the ring, until the ring gets renumbered
+	if (specificParams.renumberInterval > 0 && ++insertionsSinceRenumber >= specificParams.renumberInterval) {
+		renumberParticles();
+		insertionsSinceRenumber = 0;
+	}
+}
+
+void Surface2::renumberParticles() {
+	int n = (int)particles.size();
+	std::vector<int> order(n);
+	for (int i = 0, p = 0; i < n; ++i, p = neighbourIndices[p][1]) {
+		order[i] = p;
+	}
+	reorderParticles(order);
+
+	// in ring order, the neighbours of each particle are simply the ones before & after it
+	for (int i = 0; i < n; ++i) {
+		neighbourIndices[i] = { (i - 1 + n) % n, (i + 1) % n };
+	}
 }
 
-void Surface2::specificJson(std::string& json) {
+void Surface2::specificJson(JsonWriter& json) {
 
-	json += "\t'particles': [\n";
+	json.key("particles").beginArray();
 	for (std::size_t i = 0; i < particles.size(); ++i) {
-		json += "\t\t{\n";
-		json += "\t\t\t'position': " + particles[i].position.toString() + ",\n";
-		json += "\t\t\t'velocity': " + particles[i].velocity.toString() + ",\n";
-		json += "\t\t\t'acceleration': " + particles[i].acceleration.toString() + ",\n";
-		json += "\t\t\t'noise': 0,\n";
-		json += "\t\t\t'next': " + std::to_string(neighbourIndices[i][1]) + ",\n";
-		json += "\t\t\t'previous': " + std::to_string(neighbourIndices[i][0]) + "\n";
-		json += "\t\t}";
-		if (i < particles.size() - 1) json += ",";
-		json += "\n";
+		json.beginObject()
+			.field("position", particles.getPosition(i))
+			.field("velocity", particles.getVelocity(i))
+			.field("acceleration", particles.getAcceleration(i))
+			.field("noise", 0)
+			.field("next", neighbourIndices[i][1])
+			.field("previous", neighbourIndices[i][0])
+			.endObject();
 	}
-	json += "\t]";
+	json.endArray();
 }
 
-void Surface2::specificBinary(bio::BufferedBinaryFileOutput<>& data) {
+void Surface2::specificBinary(bio::BufferedBinaryFileOutput<>& data, int version) {
+
+	if (version >= 6 && snapshotEncoder.enabled()) {
+		std::vector<std::int32_t> next(particles.size());
+		for (std::size_t i = 0; i < particles.size(); ++i) next[i] = neighbourIndices[i][1];
+		bio::writeSimple<std::uint32_t>(data, 3);
+		snapshotEncoder.beginFrame(data);
+		snapshotEncoder.writePositions(data, particles.position, particles.size());
+		snapshotEncoder.writeEdits(data, "ENXT", 0, next.data(), next.size());
+		return;
+	}
+
+	if (version >= 6) {
+		bio::writeSimple<std::uint32_t>(data, 2);
+		bio::writeColumnHeader<real_t>(data, "POS ", 2, particles.size());
+		bio::writeVecs(data, particles.position, particles.size());
+		bio::writeColumnHeader<std::int32_t>(data, "NEXT", 1, particles.size());
+		for (std::size_t i = 0; i < particles.size(); ++i) {
+			bio::writeSimple<std::int32_t>(data, neighbourIndices[i][1]);
+		}
+		return;
+	}
 
 	// Particle positions
 	for (std::size_t i = 0; i < particles.size(); ++i) {
-		bio::writeVec(data, particles[i].position);
+		bio::writeVec(data, particles.getPosition(i));
 		bio::writeSimple<std::int32_t>(data, neighbourIndices[i][1]);
 	}
 
@@ -9,7 +9,11 @@ WARNING_DISABLE_OMP_PRAGMAS;
 
 
 /// Represents a self-avoiding surface in 2D space, made up of a certain number of particles connected in one line
-class Surface2 : public Surface<2, std::array<int, 2>::const_iterator> {
+class Surface2 : public Surface<Surface2, 2, std::array<int, 2>::const_iterator> {
+
+	// topology queries are called statically from the base
+	using Base = Surface<Surface2, 2, std::array<int, 2>::const_iterator>;
+	friend Base;
 
 public:
 
@@ -18,6 +22,7 @@ public:
 		real_t initialNoise = 0;
 		bool attachFirstParticle = false; // if true, attaches the first particle to the boundary wall
 		real_t surfaceTensionMultiplier = 1.0; // if > 1, repulsion for next-neighbours will be higher than higher-order neighbours
+		int renumberInterval = 0; // if > 0, particles get renumbered in ring order after every this many insertions, so that neighbours along the ring stay next to each other in memory
 	};
 
 private:
@@ -27,30 +32,36 @@ private:
 
 	std::vector<std::array<int, 2>> neighbourIndices; // for each particle, neighbourIndices[i] provides the next ([1]) and previous ([0]) neighbour
 
+	// Number of particles inserted since particles were last renumbered
+	int insertionsSinceRenumber = 0;
+
+	// Renumbers all particles in ring order, starting from particle 0 (which keeps its index, as it may be attached)
+	void renumberParticles();
+
 protected:
 	
 	inline Vec2 getNormal(int i) override {
-		Vec2 toCurr = particles[i].position - particles[neighbourIndices[i][0]].position;
-		Vec2 toNext = particles[neighbourIndices[i][1]].position - particles[i].position;
+		Vec2 toCurr = particles.getPosition(i) - particles.getPosition(neighbourIndices[i][0]);
+		Vec2 toNext = particles.getPosition(neighbourIndices[i][1]) - particles.getPosition(i);
 		Vec2 normal = { toCurr.Y(), -toCurr.X() }; // normal of vector from previous to current
 		normal += { toNext.Y(), -toNext.X() }; // + normal of vector from current to next
 		normal.normalize(); // normalize (i.e. average then normalize)
 		return normal;
 	}
 	
-	inline bool areNeighbours(int i, int j) override {
+	inline bool areNeighbours(int i, int j) {
 		return neighbourIndices[i][0] == j || neighbourIndices[j][0] == i;
 	}
 
-	inline std::array<int, 2>::const_iterator beginNeighbours(int i) override {
+	inline std::array<int, 2>::const_iterator beginNeighbours(int i) {
 		return neighbourIndices[i].begin();
 	}
 
-	inline std::array<int, 2>::const_iterator endNeighbours(int i) override {
+	inline std::array<int, 2>::const_iterator endNeighbours(int i) {
 		return neighbourIndices[i].end();
 	}
 
-	inline real_t getSurfaceTension(int i, int j) override {
+	inline real_t getSurfaceTension(int i, int j) {
 		if (specificParams.surfaceTensionMultiplier == 1.0) return 1.0;
 
 		// If the particles are next-nearest neighbours, apply multiplier
@@ -71,7 +82,7 @@ protected:
 		#pragma omp parallel for reduction(+: area)
 		for (int i = 0; i < particleCount; ++i) {
 			const std::array<int, 2>& neighbours = neighbourIndices[i];
-			area += particles[i].position.X() * (particles[neighbours[1]].position.Y() - particles[neighbours[0]].position.Y());
+			area += particles.getPosition(i).X() * (particles.getPosition(neighbours[1]).Y() - particles.getPosition(neighbours[0]).Y());
 		}
 		return area * real_t(0.5);
 	}
@@ -86,8 +97,8 @@ public:
 
 	void addParticle(real_t progression) override;
 
-	void specificJson(std::string& json) override;
+	void specificJson(JsonWriter& json) override;
 	
-	void specificBinary(bio::BufferedBinaryFileOutput<>& data) override;
+	void specificBinary(bio::BufferedBinaryFileOutput<>& data, int version) override;
 
 };
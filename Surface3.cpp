@@ -10,24 +10,23 @@
 WARNING_DISABLE_OMP_PRAGMAS;
 
 
-Surface3::Surface3(Surface3::Params params, SpecificParams specificParams, int seed) : Surface<3, std::unordered_set<int>::const_iterator>(params, seed), specificParams(specificParams) {
+Surface3::Surface3(Surface3::Params params, SpecificParams specificParams, int seed) : Base(params, seed), specificParams(specificParams) {
 
 	// build initial geometry (icosahedron with radius = attraction magnitude)
 	GeometryPtr icosahedron = Geometry::Icosahedron(params.attractionMagnitude);
-	particles = std::vector<Particle<3>>(icosahedron->vertices.size());
 	triangles = icosahedron->indices;
-	for (std::size_t i = 0; i < particles.size(); ++i) {
-		particles[i] = Particle<3>::FromPosition(icosahedron->vertices[i]);
+	for (std::size_t i = 0; i < icosahedron->vertices.size(); ++i) {
+		particles.push_back(Particle<3>::FromPosition(icosahedron->vertices[i]));
 		// initial particles share spherical coords with their original positions (likely never the case later)
-		particles[i].spherical = particles[i].position.normalized();
+		spherical.push_back(icosahedron->vertices[i].normalized());
 	}
 
 	if (specificParams.attachFirstParticle && params.boundary) {
-		particles.front().attached = true;
+		particles.attached[0] = 1;
 	}
 
 	// init edges amongst original geo
-	edges = std::vector<std::unordered_set<int>>(particles.size());
+	edges = std::vector<EdgeSet>(particles.size());
 #define CONNECT(a, b) edges[a].insert(b); edges[b].insert(a);
 	for (auto it = triangles.begin(); it != triangles.end(); it++) {
 		CONNECT(it->X(), it->Y());
@@ -35,6 +34,7 @@ Surface3::Surface3(Surface3::Params params, SpecificParams specificParams, int s
 		CONNECT(it->Z(), it->X());
 	}
 #undef CONNECT
+	mesh.build(triangles, (int)particles.size());
 
 	for (std::size_t i = 0; i < particles.size(); ++i) {
 		addParticleToGrid((int)i);
@@ -45,207 +45,275 @@ void Surface3::computeNormals () {
 
 	const int numParticles = int(particles.size());
 	const int numTriangles = int(triangles.size());
+	normals.resize(numParticles); // every normal is overwritten below, so the buffer is just kept across steps
 	
-	// reset all to zero
-	normals.clear();
-	Vec3 zero = Vec3::Zero();
-	for (int i = 0; i < numParticles; ++i) {
-		normals.push_back(zero);
+	// face normals normally come from the volume computation made just before, otherwise they need computing here
+	if (!faceNormalsCurrent || faceNormals.size() != triangles.size()) {
+		faceNormals.resize(numTriangles);
+		#pragma omp parallel for
+		for (int i = 0; i < numTriangles; ++i) {
+			const Vec3 a = particles.getPosition(triangles[i].X());
+			const Vec3 b = particles.getPosition(triangles[i].Y());
+			const Vec3 c = particles.getPosition(triangles[i].Z());
+			faceNormals[i] = VecUtils::cross(b-a, c-a);
+		}
 	}
-	
+	faceNormalsCurrent = false; // particles move before the next call
+
+#ifdef ATOMIC_NORMALS
+	std::fill(normals.begin(), normals.end(), Vec3::Zero());
 	#pragma omp parallel for
 	for (int i = 0; i < numTriangles; ++i) {
-		const Vec3& a = particles[triangles[i].X()].position;
-		const Vec3& b = particles[triangles[i].Y()].position;
-		const Vec3& c = particles[triangles[i].Z()].position;
-		Vec3 norm = VecUtils::cross(b-a, c-a);
-		normals[triangles[i].X()] += norm;
-		normals[triangles[i].Y()] += norm;
-		normals[triangles[i].Z()] += norm;
+		for (int k = 0; k < 3; ++k) {
+			real_t* normal = normals[triangles[i][k]].data();
+			for (int a = 0; a < 3; ++a) {
+				#pragma omp atomic
+				normal[a] += faceNormals[i][a];
+			}
+		}
 	}
-	
+
 	#pragma omp parallel for
 	for (int i = 0; i < numParticles; ++i) {
 		normals[i].normalize();
 	}
+#else
+	// per vertex, the triangles using it as one flat list (counting sort over the triangle corners), only rebuilt once the topology changed
+	if (vertexFacesStale) {
+		vertexFaceOffsets.assign(numParticles + 1, 0);
+		for (int i = 0; i < numTriangles; ++i) {
+			for (int k = 0; k < 3; ++k) ++vertexFaceOffsets[triangles[i][k] + 1];
+		}
+		for (int i = 0; i < numParticles; ++i) vertexFaceOffsets[i + 1] += vertexFaceOffsets[i];
+		vertexFaces.resize(3 * numTriangles);
+		vertexFaceCursor.assign(vertexFaceOffsets.begin(), vertexFaceOffsets.end() - 1);
+		for (int i = 0; i < numTriangles; ++i) {
+			for (int k = 0; k < 3; ++k) vertexFaces[vertexFaceCursor[triangles[i][k]]++] = i;
+		}
+		vertexFacesStale = false;
+	}
+
+	// gather the face normals around each vertex, so that every normal is only written by one thread
+	#pragma omp parallel for
+	for (int i = 0; i < numParticles; ++i) {
+		Vec3 sum = Vec3::Zero();
+		for (int f = vertexFaceOffsets[i]; f < vertexFaceOffsets[i + 1]; ++f) {
+			sum += faceNormals[vertexFaces[f]];
+		}
+		normals[i] = sum.normalized();
+	}
+#endif
 }
 
 void Surface3::addParticle(real_t) {
+	vertexFacesStale = true;
 	switch (specificParams.strategy) {
 	case GrowthStrategy::ON_EDGE:
 		addParticleEdge();
-		return;
+		break;
 	case GrowthStrategy::DELAUNAY:
 		addParticleDelaunay();
-		return;
+		break;
 	case GrowthStrategy::DELAUNAY_ANISO_EDGE:
 		addParticleEdgeDelaunay();
-		return;
+		break;
 	default:
 		std::printf("Error: invalid growth strategy!");
 		std::exit(1);
 	}
+	secondRingsStale = true;
 }
 
-void Surface3::specificJson(std::string& json) {
+void Surface3::update(real_t progression) {
+	if (secondRingsStale && specificParams.surfaceTensionMultiplier != 1.0) {
+		updateSecondRings();
+	}
+	Base::update(progression);
+}
+
+void Surface3::updateSecondRings() {
+
+	// each vertex gets a slot big enough for all of its neighbours' neighbours, then keeps the sorted unique ones at its start
+	const int numParticles = int(particles.size());
+	secondRingOffsets.resize(numParticles + 1);
+	secondRingCounts.resize(numParticles);
+	secondRingOffsets[0] = 0;
+	for (int i = 0; i < numParticles; ++i) {
+		int bound = 0;
+		for (int n : edges[i]) bound += int(edges[n].size());
+		secondRingOffsets[i + 1] = secondRingOffsets[i] + bound;
+	}
+	secondRings.resize(secondRingOffsets[numParticles]);
+
+	#pragma omp parallel for
+	for (int i = 0; i < numParticles; ++i) {
+		int* first = secondRings.data() + secondRingOffsets[i];
+		int* last = first;
+		for (int n : edges[i]) {
+			for (int m : edges[n]) *last++ = m;
+		}
+		std::sort(first, last);
+		secondRingCounts[i] = int(std::unique(first, last) - first);
+	}
+	secondRingsStale = false;
+}
 
-	json += "\t'growthStrategy': ";
+void Surface3::specificJson(JsonWriter& json) {
+
+	json.key("growthStrategy");
 	switch (specificParams.strategy) {
-	case GrowthStrategy::ON_EDGE:				json += "'edge'";			break;
-	case GrowthStrategy::DELAUNAY:				json += "'delaunay'";		break;
-	case GrowthStrategy::DELAUNAY_ANISO_EDGE:	json += "'delaunay-aniso'";	break;
+	case GrowthStrategy::ON_EDGE:				json.value("edge");				break;
+	case GrowthStrategy::DELAUNAY:				json.value("delaunay");			break;
+	case GrowthStrategy::DELAUNAY_ANISO_EDGE:	json.value("delaunay-aniso");	break;
 	}
-	json += ",\n";
 
-	json += "\t'particles': [\n";
+	json.key("particles").beginArray();
 	for (std::size_t i = 0; i < particles.size(); ++i) {
-		json += "\t\t{\n";
-		json += "\t\t\t'position': " + particles[i].position.toString() + ",\n";
-		json += "\t\t\t'velocity': " + particles[i].velocity.toString() + ",\n";
-		json += "\t\t\t'acceleration': " + particles[i].acceleration.toString() + ",\n";
-		json += "\t\t\t'spherical': " + particles[i].spherical.toString() + ",\n";
-		json += "\t\t\t'noise': 0,\n";
-		json += "\t\t}";
-		if (i < particles.size() - 1) json += ",";
-		json += "\n";
+		json.beginObject()
+			.field("position", particles.getPosition(i))
+			.field("velocity", particles.getVelocity(i))
+			.field("acceleration", particles.getAcceleration(i))
+			.field("spherical", spherical[i])
+			.field("noise", 0)
+			.endObject();
 	}
-	json += "\t],\n";
+	json.endArray();
 
-	json += "\t'triangles': [\n";
+	json.key("triangles").beginArray();
 	for (std::size_t i = 0; i < triangles.size(); ++i) {
-		json += "\t\t" + triangles[i].toString();
-		if (i < triangles.size() - 1) json += ",";
-		json += "\n";
+		json.value(triangles[i]);
 	}
-	json += "\t]\n";
+	json.endArray();
 
 }
 
-void Surface3::specificBinary(bio::BufferedBinaryFileOutput<>& data) {
+void Surface3::specificBinary(bio::BufferedBinaryFileOutput<>& data, int version) {
 
-	// Particle positions
-	for (std::size_t i = 0; i < particles.size(); ++i) {
-		bio::writeVec(data, particles[i].position);
+	if (version >= 6 && snapshotEncoder.enabled()) {
+		bio::writeSimple<std::uint32_t>(data, 3);
+		snapshotEncoder.beginFrame(data);
+		snapshotEncoder.writePositions(data, particles.position, particles.size());
+		static_assert(sizeof(IVec3) == 3 * sizeof(std::int32_t), "triangles are written as a flat array of their indices");
+		snapshotEncoder.writeEdits(data, "ETRI", 0, triangles.front().data(), triangles.size() * 3);
+		return;
 	}
 
+	if (version >= 6) {
+		bio::writeSimple<std::uint32_t>(data, 2);
+		bio::writeColumnHeader<real_t>(data, "POS ", 3, particles.size());
+		bio::writeVecs(data, particles.position, particles.size());
+		bio::writeColumnHeader<std::int32_t>(data, "TRI ", 3, triangles.size());
+		bio::writeVecs(data, triangles.data(), triangles.size());
+		return;
+	}
+
+	// Particle positions
+	bio::writeVecs(data, particles.position, particles.size());
+
 	// Triangle indices
 	bio::writeSimple<std::int32_t>(data, (std::int32_t)triangles.size());
-	for (std::size_t i = 0; i < triangles.size(); ++i) {
-		bio::writeVec(data, triangles[i]);
-	}
+	bio::writeVecs(data, triangles.data(), triangles.size());
 
 }
 
 
 
 
+void Surface3::pickEdge(int& a, int& b) {
+	if (specificParams.uniformEdges) {
+		mesh.randomEdge(triangles, rand01(), a, b);
+		return;
+	}
+
+	// random particle, then one of its neighbours (never its last one, as this has always picked the first one for the two lowest draws)
+	a = int(rand01() * edges.size());
+	int bIdx = int(rand01() * edges[a].size());
+	b = edges[a].begin()[std::max(0, bIdx - 1)];
+}
+
 void Surface3::addParticleEdge() {
 
 	// get 2 random connected particles among the existing set and insert a new one in the middle
-	int a = int(rand01() * edges.size());
-	int bIdx = int(rand01() * edges[a].size());
-	int b = -1; // O(N log N) random access in set - done here because these sets are likely to be kept fairly small ideally
-	for (auto it = edges[a].begin(); it != edges[a].end(); it++) {
-		--bIdx;
-		if (bIdx <= 0) {
-			b = *it;
-			break;
-		}
-	}
+	int a, b;
+	pickEdge(a, b);
 	assert(b > -1);
 	int c = (int)particles.size();
-	particles.push_back(Particle<3>::FromPosition(Vec3::Lerp(particles[a].position, particles[b].position, 0.5)));
+	particles.push_back(Particle<3>::FromPosition(Vec3::Lerp(particles.getPosition(a), particles.getPosition(b), 0.5)));
 
 	// update edge map
-	edges.push_back(std::unordered_set<int>());
+	edges.push_back(EdgeSet());
 	edges[a].erase(b);		edges[b].erase(a);
 	edges[a].insert(c);		edges[b].insert(c);
 	edges[c].insert(a);		edges[c].insert(b);
 
-	// replace any tris sharing edge [a,b] with two tris new tris on either side of C
-	// @todo: this O(N) step can be replaced with an equivalent O(1) step with an edge -> triangle map
-	std::size_t size = triangles.size();
-	for (std::size_t i = 0; i < size; ++i) {
-		auto it = &triangles[i];
-		int d = it->X();
-		int e = it->Y();
-		int f = it->Z();
-		if ((d == a && e == b) || (d == b && e == a)) { // tri with F
-			it->setX(c); // replace with a, c, f
-			triangles.push_back(IVec3(d, c, f)); // add b, c, f
-			edges[c].insert(f);
-			edges[f].insert(c);
-		} else if ((e == a && f == b) || (e == b && f == a)) { // tri with D
-			it->setY(c); // replace with d, c, a
-			triangles.push_back(IVec3(d, e, c)); // add d, c, b
-			edges[c].insert(d);
-			edges[d].insert(c);
-		} else if ((f == a && d == b) || (f == b && d == a)) { // tri with E
-			it->setZ(c); // replace with a, e, c
-			triangles.push_back(IVec3(f, c, e)); // add b, e, c
-			edges[c].insert(e);
-			edges[e].insert(c);
-		}
-	}
+	// replace both tris sharing edge [a,b] with two new tris on either side of C, connecting C to the vertex opposite the edge
+	mesh.splitEdge(triangles, a, b, c, [&](int, int opposite) {
+		edges[c].insert(opposite);
+		edges[opposite].insert(c);
+	});
+	invalidateVolume();
 
 	addParticleToGrid((int)particles.size() - 1);
 
 }
 
-void Surface3::addParticleDelaunay() {
+void Surface3::insertSpherical(int nearVertex) {
+	edges.push_back(EdgeSet()); // add slot for the new particle in the edge map
+	invalidateVolume();
+	if (!sphericalDelaunay) {
+		// the initial geometry isn't a Delaunay triangulation of its spherical coordinates (the first vertex was moved to the pole), so start from scratch once
+		sd::SphericalDelaunay(spherical, triangles, edges);
+		mesh.build(triangles, (int)spherical.size());
+		sphericalDelaunay = true;
+	} else {
+		mesh.insert(spherical, (int)spherical.size() - 1, nearVertex, triangles, edges);
+	}
+}
 
-	// @todo For now, this takes around 10x as long to compute as addParticle() since the entire mesh is retriangulated
+void Surface3::addParticleDelaunay() {
 
-	particles.push_back(Particle<3>::Zero());
-	Particle<3>& p = particles.back();
+	Particle<3> p = Particle<3>::Zero();
 
 	// place particle anywhere on the unit sphere
+	Vec3 s;
 	do {
 		do {
-			p.spherical = Vec3(rand01() - 0.5, rand01() - 0.5, rand01() - 0.5);
-		} while (p.spherical.lengthSqr() == 0); // prevent from creating point (0,0,0)
-		p.spherical.normalize();
-	} while (p.spherical.Y() == 1); // prevent from placing a point at the north pole
+			s = Vec3(rand01() - 0.5, rand01() - 0.5, rand01() - 0.5);
+		} while (s.lengthSqr() == 0); // prevent from creating point (0,0,0)
+		s.normalize();
+	} while (s.Y() == 1); // prevent from placing a point at the north pole
+	spherical.push_back(s);
 
 	// update the triangulation including the new particle
-	edges.push_back(std::unordered_set<int>()); // add slot for the new particle in the edge map
-	sd::SphericalDelaunay(particles, triangles, edges);
+	insertSpherical(-1);
 
 	// set other fields of p to averages amongst spherical neighbours for now (will update with everything else later on)
+	int c = (int)particles.size();
 #ifndef NO_UPDATE
-	for (int neighbour : edges[particles.size() - 1]) {
-		p.position += particles[neighbour].position;
+	for (int neighbour : edges[c]) {
+		p.position += particles.getPosition(neighbour);
 	}
-	p.position *= (real_t)1 / edges[particles.size() - 1].size();
+	p.position *= (real_t)1 / edges[c].size();
 #else
-	p.position = p.spherical;
+	p.position = s;
 #endif
 
-	addParticleToGrid((int)particles.size() - 1);
+	particles.push_back(p);
+	addParticleToGrid(c);
 }
 
 void Surface3::addParticleEdgeDelaunay() {
 
-	particles.push_back(Particle<3>::Zero());
-	Particle<3>& p = particles.back();
+	Particle<3> p = Particle<3>::Zero();
 
 	// pick two neighbouring particles with higher probability on edges aligned with Z
 	int a = -1, b = -1;
 	do {
-		a = int(rand01() * edges.size());
-		int bIdx = int(rand01() * edges[a].size());
-		// O(N log N) random access in set - done here because these sets are likely to be kept fairly small ideally
-		for (auto it = edges[a].begin(); it != edges[a].end(); it++) {
-			--bIdx;
-			if (bIdx <= 0) {
-				b = *it;
-				break;
-			}
-		}
+		pickEdge(a, b);
 		assert(b > -1);
 		assert((std::size_t)a < particles.size());
 		assert((std::size_t)b < particles.size());
-		Vec3 dir = particles[a].position - particles[b].position;
+		Vec3 dir = particles.getPosition(a) - particles.getPosition(b);
 		dir.normalize();
 		if (rand01() < std::abs(dir.Z())) {
 			break;
@@ -255,22 +323,24 @@ void Surface3::addParticleEdgeDelaunay() {
 	// place particle between the two selected on the unit sphere
 	assert(a > -1 && (std::size_t)a < particles.size());
 	assert(b > -1 && (std::size_t)b < particles.size());
-	p.spherical = particles[a].spherical + particles[b].spherical;
-	p.spherical.normalize();
+	Vec3 s = spherical[a] + spherical[b];
+	s.normalize();
+	spherical.push_back(s);
 
-	// update the triangulation including the new particle
-	edges.push_back(std::unordered_set<int>()); // add slot for the new particle in the edge map
-	sd::SphericalDelaunay(particles, triangles, edges);
+	// update the triangulation including the new particle, which lies right next to a
+	insertSpherical(a);
 
 	// set other fields of p to averages amongst spherical neighbours for now (will update with everything else later on)
+	int c = (int)particles.size();
 #ifndef NO_UPDATE
-	for (int neighbour : edges[particles.size() - 1]) {
-		p.position += particles[neighbour].position;
+	for (int neighbour : edges[c]) {
+		p.position += particles.getPosition(neighbour);
 	}
-	p.position *= (real_t)1 / edges[particles.size() - 1].size();
+	p.position *= (real_t)1 / edges[c].size();
 #else
-	p.position = p.spherical;
+	p.position = s;
 #endif
 
-	addParticleToGrid((int)particles.size() - 1);
+	particles.push_back(p);
+	addParticleToGrid(c);
 }
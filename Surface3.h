@@ -1,12 +1,23 @@
 #pragma once
 
+#include <algorithm>
+
 #include "Surface.h"
+#include "SmallSet.h"
+#include "SphericalTriangulation.h"
 
 #include "real.h"
 
 
+/// Neighbours of a single mesh vertex (about 6 on average)
+using EdgeSet = SmallSet<int, 8>;
+
 /// Represents a self-avoiding surface in 3D space, made up of a certain number of particles
-class Surface3 : public Surface<3, std::unordered_set<int>::const_iterator> {
+class Surface3 : public Surface<Surface3, 3, EdgeSet::const_iterator> {
+
+	// topology queries are called statically from the base
+	using Base = Surface<Surface3, 3, EdgeSet::const_iterator>;
+	friend Base;
 
 public:
 
@@ -20,6 +31,7 @@ public:
 		bool attachFirstParticle = false; // if true, attaches the first particle to the boundary wall (@todo: would be better to attach a group of particles e.g. in a row)
 		GrowthStrategy strategy = GrowthStrategy::DELAUNAY;
 		real_t surfaceTensionMultiplier = real_t(1.0);
+		bool uniformEdges = false; // if true, edges to grow on are picked uniformly (rather than a random vertex, then a random neighbour of it)
 	};
 
 private:
@@ -27,14 +39,39 @@ private:
 	// Additional parameters on top of the Surface<3>::Params
 	SpecificParams specificParams;
 
+	// Position of each particle on the unit sphere (for spherical Delaunay triangulation)
+	std::vector<Vec3> spherical;
+
 	// List of triangles
 	std::vector<IVec3> triangles;
 	
 	// List of vertex normals (same length as particles)
 	std::vector<Vec3> normals;
 
+	// Per triangle, the cross product of its edges (area-weighted normal), as of the last getVolume() call
+	std::vector<Vec3> faceNormals;
+	bool faceNormalsCurrent = false;
+
+	// Triangles using each vertex (vertexFaces[vertexFaceOffsets[i]..vertexFaceOffsets[i + 1]]), for gathering vertex normals; stale after any topology change
+	std::vector<int> vertexFaceOffsets;
+	std::vector<int> vertexFaces;
+	std::vector<int> vertexFaceCursor;
+	bool vertexFacesStale = true;
+
 	// Edge map < vertex index -> [ nearest neighbour vertex indices ] >
-	std::vector<std::unordered_set<int>> edges;
+	std::vector<EdgeSet> edges;
+
+	// Per vertex, the sorted vertices sharing a neighbour with it (secondRings[secondRingOffsets[i]..+secondRingCounts[i]], including i itself), when surface tension is used; stale after any topology change
+	std::vector<int> secondRingOffsets;
+	std::vector<int> secondRingCounts;
+	std::vector<int> secondRings;
+	bool secondRingsStale = true;
+
+	// Triangle adjacency (edge -> triangle map & vertex one-rings), which for Delaunay growth strategies is also the spherical Delaunay triangulation
+	sd::SphericalTriangulation mesh;
+
+	// Whether the triangles are a Delaunay triangulation of the spherical coordinates yet (Delaunay growth strategies rebuild them on the first insertion)
+	bool sphericalDelaunay = false;
 
 protected:
 	
@@ -45,41 +82,40 @@ protected:
 		return normals[i];
 	}
 	
-	inline bool areNeighbours(int i, int j) override {
-		return edges[i].find(j) != edges[i].end();
+	inline bool areNeighbours(int i, int j) {
+		return edges[i].contains(j);
 	}
 
-	inline std::unordered_set<int>::const_iterator beginNeighbours(int i) override {
+	inline EdgeSet::const_iterator beginNeighbours(int i) {
 		return edges[i].begin();
 	}
 
-	inline std::unordered_set<int>::const_iterator endNeighbours(int i) override {
+	inline EdgeSet::const_iterator endNeighbours(int i) {
 		return edges[i].end();
 	}
 
-	inline real_t getSurfaceTension(int i, int j) override {
+	inline real_t getSurfaceTension(int i, int j) {
 		if (specificParams.surfaceTensionMultiplier == 1.0) return 1.0;
 		
 		// If the particles are next-nearest neighbours (i.e. at least one vertex in the intersection of their neighbour sets), apply multiplier
-		for (auto it1 = edges[i].begin(); it1 != edges[i].end(); it1++) {
-			for (auto it2 = edges[j].begin(); it2 != edges[j].end(); it2++) {
-				if (*it1 == *it2) {
-					return specificParams.surfaceTensionMultiplier;
-				}
-			}
+		const int* first = secondRings.data() + secondRingOffsets[i];
+		if (std::binary_search(first, first + secondRingCounts[i], j)) {
+			return specificParams.surfaceTensionMultiplier;
 		}
 		return 1.0;
 	}
 	
 	inline real_t getVolume() override {
-		// compute volume enclosed within the surface
+		// compute volume enclosed within the surface, keeping the face normals for computeNormals() on the way
 		real_t volume = 0;
 		int triangleCount = int(triangles.size());
+		faceNormals.resize(triangleCount);
 		#pragma omp parallel for reduction(+: volume)
 		for (int i = 0; i < triangleCount; ++i) {
-			const Vec3& a = particles[triangles[i].X()].position;
-			const Vec3& b = particles[triangles[i].Y()].position;
-			const Vec3& c = particles[triangles[i].Z()].position;
+			const Vec3 a = particles.getPosition(triangles[i].X());
+			const Vec3 b = particles.getPosition(triangles[i].Y());
+			const Vec3 c = particles.getPosition(triangles[i].Z());
+			faceNormals[i] = VecUtils::cross(b - a, c - a);
 			// compute signed volume of triangle
 			real_t vCBA = c.X() * b.Y() * a.Z();
 			real_t vBCA = b.X() * c.Y() * a.Z();
@@ -89,6 +125,7 @@ protected:
 			real_t vABC = a.X() * b.Y() * c.Z();
 			volume += (-vCBA + vBCA + vCAB - vACB - vBAC + vABC) / real_t(6);
 		}
+		faceNormalsCurrent = true;
 		return volume;
 	}
 	
@@ -103,11 +140,14 @@ public:
 	/// Adds a particle in a random location on the surface
 	void addParticle(real_t progression) override;
 
+	/// Updates the particles, bringing the second rings up to date with the topology first
+	void update(real_t progression) override;
+
 	/// Add specific info to the json string
-	void specificJson(std::string& json) override;
+	void specificJson(JsonWriter& json) override;
 
 	/// Add specific info to the binary stream
-	void specificBinary(bio::BufferedBinaryFileOutput<>& data) override;
+	void specificBinary(bio::BufferedBinaryFileOutput<>& data, int version) override;
 
 private:
 
@@ -120,4 +160,13 @@ private:
 	/// Adds a particle on an aligned edge (anisotropic growth), using Delaunay trigulation
 	void addParticleEdgeDelaunay();
 
+	/// Rebuilds the second rings from the edge map
+	void updateSecondRings();
+
+	/// Picks two connected particles to grow between
+	void pickEdge(int& a, int& b);
+
+	/// Inserts the last spherical coordinates into the Delaunay triangulation, updating triangles and edges (walking from nearVertex if >= 0)
+	void insertSpherical(int nearVertex);
+
 };
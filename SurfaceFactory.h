@@ -51,6 +51,8 @@ namespace SurfaceFactory {
                 );
             }
             params.dt = args.read<real_t>("dt", real_t(.15));
+            params.verletSkin = args.read<real_t>("verlet-skin", real_t(0));
+            params.halfShell = args.read<bool>("half-shell", false);
             return params;
         }
         
@@ -81,9 +83,22 @@ namespace SurfaceFactory {
                 args.read<bool>("boundary-offset", sealPreset)
             ) : nullptr;
             params.dt = args.read<real_t>("dt", real_t(0.5));
+            params.verletSkin = args.read<real_t>("verlet-skin", real_t(0));
+            params.halfShell = args.read<bool>("half-shell", false);
             return params;
         }
         
+        // Verlet lists only hold pairs within getInteractionRange() + skin, so they would silently drop interactions whose radius can grow past that range:
+        // repulsion by max neighbour distance, adaptive repulsion, and surface tension > 1 all allow it - such runs keep the plain grid instead
+        template<typename Params>
+        void checkVerletRange (Params& params, real_t surfaceTensionMultiplier) {
+            if (params.verletSkin <= 0) return;
+            if (params.repelByMaxNeighbourDist || params.adaptiveRepulsion > 0 || surfaceTensionMultiplier > 1) {
+                std::printf("Verlet lists turned off: repulsion radii may exceed the interaction range with -rep-max-neighbour, -adaptive-repulsion or -surface-tension > 1.\n");
+                params.verletSkin = 0;
+            }
+        }
+        
         template<int D>
         typename Tree<D>::SpecificParams buildTreeSParams (Arguments& args, bool sealPreset) {
             typename Tree<D>::SpecificParams specificParams;
@@ -98,6 +113,23 @@ namespace SurfaceFactory {
             return specificParams;
         }
         
+        // Specialises the acceleration kernel of a newly built surface for the concrete type of its boundary condition,
+        // so that boundary forces no longer go through virtual calls (unknown boundary types keep the generic kernel)
+        template<int D, typename T>
+        T* specialiseKernels (T* surface, const typename T::Params& params) {
+            BoundaryCondition<D>* boundary = params.boundary.get();
+            if (!boundary) {
+                surface->template selectKernels<void>();
+            } else if (dynamic_cast<SphereBoundary<D>*>(boundary)) {
+                surface->template selectKernels<SphereBoundary<D>>();
+            } else if constexpr (D == 3) {
+                if (dynamic_cast<CylinderBoundary*>(boundary)) {
+                    surface->template selectKernels<CylinderBoundary>();
+                }
+            }
+            return surface;
+        }
+        
     }
     
     
@@ -115,7 +147,9 @@ namespace SurfaceFactory {
         // Depending on dimensionality and type, build up the model to use
         if (d == 3) {
             if (tree) {
-                surface = new Tree<3>(buildSurface3Params<Tree<3>>(args), buildTreeSParams<3>(args, false), seed);
+                auto params = buildSurface3Params<Tree<3>>(args);
+                checkVerletRange(params, 1);
+                surface = specialiseKernels<3>(new Tree<3>(params, buildTreeSParams<3>(args, false), seed), params);
             } else {
                 auto params = buildSurface3Params<>(args);
                 Surface3::SpecificParams specificParams;
@@ -129,11 +163,15 @@ namespace SurfaceFactory {
                     specificParams.strategy = Surface3::GrowthStrategy::DELAUNAY;
                 }
                 specificParams.surfaceTensionMultiplier = args.read<real_t>("surface-tension", 1);
-                surface = new Surface3(params, specificParams, seed);
+                specificParams.uniformEdges = args.read<bool>("uniform-edges", false);
+                checkVerletRange(params, specificParams.surfaceTensionMultiplier);
+                surface = specialiseKernels<3>(new Surface3(params, specificParams, seed), params);
             }
         } else if (d == 2) {
             if (tree) {
-                surface = new Tree<2>(buildSurface2Params<Tree<2>>(args, sealPreset), buildTreeSParams<2>(args, sealPreset), seed);
+                auto params = buildSurface2Params<Tree<2>>(args, sealPreset);
+                checkVerletRange(params, 1);
+                surface = specialiseKernels<2>(new Tree<2>(params, buildTreeSParams<2>(args, sealPreset), seed), params);
             } else {
                 auto params = buildSurface2Params<>(args, false);
                 Surface2::SpecificParams specificParams;
@@ -141,7 +179,9 @@ namespace SurfaceFactory {
                 specificParams.initialNoise = args.read<real_t>("initial-noise", 0);
                 specificParams.attachFirstParticle = args.read<bool>("attach-first", false);
                 specificParams.surfaceTensionMultiplier = args.read<real_t>("surface-tension", 1);
-                surface = new Surface2(params, specificParams, seed);
+                specificParams.renumberInterval = args.read<int>("renumber-interval", 0);
+                checkVerletRange(params, specificParams.surfaceTensionMultiplier);
+                surface = specialiseKernels<2>(new Surface2(params, specificParams, seed), params);
             }
         } else {
             std::printf("Error: invalid dimensionality %d! Must select 2 or 3.", d);
@@ -1,25 +1,35 @@
 #pragma once
 
+#include <array>
+#include <algorithm>
+
 #include "Surface.h"
 
-#include <unordered_set>
+#include "SmallSet.h"
+#include "BackboneDimension.h"
 #include "real.h"
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
 #endif
 
+/// Neighbours of a single tree node (rarely more than 3)
+using TreeNeighbourSet = SmallSet<int, 4>;
+
 /// Represents a self-avoiding tree/graph in 2D/3D space, made up of a certain number of particles connected by lines
 template<int D>
-class Tree : public Surface<D, std::unordered_set<int>::const_iterator> {
+class Tree : public Surface<Tree<D>, D, TreeNeighbourSet::const_iterator> {
 	
 	// resolve non dependent names
-	using Base = Surface<D, std::unordered_set<int>::const_iterator>;
+	using Base = Surface<Tree<D>, D, TreeNeighbourSet::const_iterator>;
+	friend Base; // topology queries are called statically from the base
 	using Base::particles;
 	using Base::addParticleToGrid;
 	using Base::rand01;
 	using Base::rng;
 	using Base::params;
+	using Base::invalidateVolume;
+	using Base::snapshotEncoder;
     using Base::getNearbyParticleCount;
 	
 public:
@@ -45,26 +55,36 @@ private:
     // Flipped to true when t first reaches stopBranchingAfter
     bool hasStoppedBranching = false;
 	
-	std::vector<std::unordered_set<int>> neighbourIndices; // for each particle, neighbourIndices provides all the neighbours
+	std::vector<TreeNeighbourSet> neighbourIndices; // for each particle, neighbourIndices provides all the neighbours
 	std::vector<int> youngIndices; // set of particle indices that are still considered 'young' enough for new growth to occur
 	
-	// Given a particle idx, returns the number of particles that need to be traversed to get to a branch
-	inline int distanceToBranch (int i, int comingFrom = -1) {
-		
-		// if the node has more than 2 neighbours, it's a branch
-		if (neighbourIndices[i].size() > 2) {
-			return 0;
-		}
-		
-		// go over the neighbours (max 2 iterations), ignoring the node we're coming from, and return the branch distance of the new neighbour
-		for (auto it = neighbourIndices[i].begin(); it != neighbourIndices[i].end(); it++) {
-			if (*it == comingFrom) continue;
-			return 1 + distanceToBranch(*it, i);
+	// For each leaf (node with a single neighbour), the number of particles that need to be traversed to get to a branch (or to the other end of the tree, if it has no branch yet)
+	std::vector<int> branchDistance;
+	int branchCount = 0; // number of nodes with more than 2 neighbours
+	
+	// If growthMaxLeafDistance > 0, for each particle the number of particles that need to be traversed to get to the nearest leaf, capped at growthMaxLeafDistance + 1
+	std::vector<int> leafDistance;
+	
+	// Scratch space for updateLeafDistances(): particles close enough to the last attachment for their leaf distance to change, along with where they were reached from
+	std::vector<std::array<int, 3>> leafDistanceBall;
+	
+	// Walks along the unbranched chain starting with the step from -> next, through particles with exactly 2 neighbours
+	// Returns the particle it stops at (a branch or a leaf), and the number of steps taken
+	inline int walkChain (int from, int next, int& steps) const {
+		steps = 1;
+		while (neighbourIndices[next].size() == 2) {
+			const int* nb = neighbourIndices[next].begin();
+			int after = nb[0] == from ? nb[1] : nb[0];
+			from = next;
+			next = after;
+			++steps;
 		}
-		
-		// if we get here, the only neighbour for the node is the node we're coming from, i.e. no more nodes to explore
-		return 0;
+		return next;
 	}
+	
+	// Updates the cached distances after particle c got attached to particle a
+	void updateBranchDistances (int a, int c);
+	void updateLeafDistances (int a);
     
 protected:
 	
@@ -72,19 +92,19 @@ protected:
 		return Vec<real_t, D>::Zero(); // @todo; can pressure force even exist in the tree?
 	}
 	
-	inline bool areNeighbours(int i, int j) override {
-		return neighbourIndices[i].find(j) != neighbourIndices[i].end();
+	inline bool areNeighbours(int i, int j) {
+		return neighbourIndices[i].contains(j);
 	}
 	
-	inline std::unordered_set<int>::const_iterator beginNeighbours(int i) override {
+	inline TreeNeighbourSet::const_iterator beginNeighbours(int i) {
 		return neighbourIndices[i].begin();
 	}
 	
-	inline std::unordered_set<int>::const_iterator endNeighbours(int i) override {
+	inline TreeNeighbourSet::const_iterator endNeighbours(int i) {
 		return neighbourIndices[i].end();
 	}
 	
-	inline real_t getSurfaceTension([[maybe_unused]] int i, [[maybe_unused]] int j) override {
+	inline real_t getSurfaceTension([[maybe_unused]] int i, [[maybe_unused]] int j) {
 		return 1.0; // no repulsion deltas (surface tension) in trees yet @todo
 	}
 	
@@ -96,7 +116,7 @@ protected:
 		for (int i = 0; i < particleCount; ++i) {
 			for (auto it = neighbourIndices[i].begin(); it != neighbourIndices[i].end(); it++) {
 				const int& j = *it;
-				length += std::sqrt((particles[i].position - particles[j].position).lengthSqr());
+				length += std::sqrt((particles.getPosition(i) - particles.getPosition(j)).lengthSqr());
 			}
 		}
 		return length * 0.5f; // half, since we counted each branch twice
@@ -106,29 +126,45 @@ protected:
 		return "t" + std::to_string(D);
 	}
 	
-    bool isNodeWithinLeafDistance(int node, int maxDistance, int parent = -1);
-    
 public:
 	
 	Tree(typename Tree<D>::Params params, SpecificParams specificParams, int seed = time(nullptr));
 	
 	void addParticle(real_t progression) override;
 	
-	void specificJson(std::string& json) override;
+	void specificJson(JsonWriter& json) override;
 	
-	void specificBinary(bio::BufferedBinaryFileOutput<>& data) override;
+	void specificBinary(bio::BufferedBinaryFileOutput<>& data, int version) override;
     
+    /// Writes the (euclidean, geodesic) distance pair between every two nodes considered for the backbone dimension (RAW), in order of the first node then depth-first from it
     void backboneDimensionSamples (bio::BufferedBinaryFileOutput<>& data);
     
+    /// Accumulates the same pairs as backboneDimensionSamples() into a histogram & fit, without storing them
+    BackboneDimensionHistogram backboneDimensionHistogram ();
+    
 private:
-    void backboneDimensionSample (bio::BufferedBinaryFileOutput<>& data, int node, int comingFrom, int originalNode, real_t geodesicDistance);
+    
+    /// Node left to visit by forEachBackbonePair(), along with the node it was reached from and the geodesic distance to it
+    struct BackboneStep {
+        int node;
+        int comingFrom;
+        real_t geodesicDistance;
+    };
+    
+    /// Nodes from which backbone dimension samples are taken
+    std::vector<int> backboneDimensionSources ();
+    
+    /// Calls f(euclidean, geodesic) for every node considered for the backbone dimension reached from the given one, depth-first in neighbour order
+    /// Iterative, so that long branches can't overflow the call stack; stack is scratch space
+    template<typename F>
+    void forEachBackbonePair (int source, std::vector<BackboneStep>& stack, F f);
 	
 };
 
 
 
 template<int D>
-Tree<D>::Tree(typename Tree<D>::Params params, SpecificParams specificParams, int seed) : Surface<D, std::unordered_set<int>::const_iterator>(params, seed), specificParams(specificParams) {
+Tree<D>::Tree(typename Tree<D>::Params params, SpecificParams specificParams, int seed) : Base(params, seed), specificParams(specificParams) {
 	
     // initial state: 2 particles connected together
     particles.push_back(Particle<D>::FromPosition(Vec<real_t, D>::Zero()));
@@ -136,7 +172,7 @@ Tree<D>::Tree(typename Tree<D>::Params params, SpecificParams specificParams, in
 	secondPartPosition.setX(params.attractionMagnitude);
     particles.push_back(Particle<D>::FromPosition(secondPartPosition));
     if (specificParams.attachFirstParticle && params.boundary) {
-        particles.front().attached = true;
+        particles.attached[0] = 1;
     } else {
         youngIndices.push_back(0);
     }
@@ -145,23 +181,70 @@ Tree<D>::Tree(typename Tree<D>::Params params, SpecificParams specificParams, in
     neighbourIndices.push_back({ 0 });
     addParticleToGrid(0);
     addParticleToGrid(1);
+    branchDistance = { 1, 1 };
+    if (specificParams.growthMaxLeafDistance > 0) {
+        leafDistance = { 0, 0 };
+    }
 }
 
 template<int D>
-bool Tree<D>::isNodeWithinLeafDistance(int node, int maxDistance, int parent) {
+void Tree<D>::updateBranchDistances(int a, int c) {
     
-    if (maxDistance < 0) return false;
-    
-    if (neighbourIndices[node].size() == 1) return true;
-    
-    for (int neighbour : neighbourIndices[node]) {
-        if (neighbour == parent) continue;
-        if (isNodeWithinLeafDistance(neighbour, maxDistance - 1, node)) {
-            return true;
+    branchDistance.push_back(0);
+    int degree = (int)neighbourIndices[a].size();
+    int steps;
+    if (degree == 2) {
+        // a was a leaf: the chain it ended now ends at c instead, one step further
+        branchDistance[c] = 1 + branchDistance[a];
+        if (branchCount == 0) {
+            // no branch anywhere: the tree is a single chain, whose other end is now one step further from its end too
+            int other = *neighbourIndices[a].begin() == c ? *(neighbourIndices[a].begin() + 1) : *neighbourIndices[a].begin();
+            int end = walkChain(a, other, steps);
+            branchDistance[end] = steps + 1;
+        }
+    } else {
+        branchDistance[c] = 1;
+        if (degree == 3) {
+            // a just became a branch, splitting the chain running through it: leaves at its ends are now closer to a branch
+            ++branchCount;
+            for (int n : neighbourIndices[a]) {
+                if (n == c) continue;
+                int end = walkChain(a, n, steps);
+                if (neighbourIndices[end].size() == 1) branchDistance[end] = steps;
+            }
         }
     }
+}
+
+template<int D>
+void Tree<D>::updateLeafDistances(int a) {
     
-    return false;
+    // only particles within growthMaxLeafDistance of a can see a difference below the cap (a may have stopped being a leaf, and has a new leaf next to it)
+    // gather them breadth-first, then settle their distances from those of the particles around them
+    const int cap = specificParams.growthMaxLeafDistance + 1;
+    leafDistance.resize(particles.size(), cap);
+    leafDistanceBall.clear();
+    leafDistanceBall.push_back({ a, -1, 0 }); // particle, particle it was reached from, depth
+    for (std::size_t b = 0; b < leafDistanceBall.size(); ++b) {
+        auto [node, from, depth] = leafDistanceBall[b];
+        leafDistance[node] = cap;
+        if (depth == specificParams.growthMaxLeafDistance) continue;
+        for (int n : neighbourIndices[node]) {
+            if (n != from) leafDistanceBall.push_back({ n, node, depth + 1 });
+        }
+    }
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (const auto& entry : leafDistanceBall) {
+            int node = entry[0];
+            int distance = neighbourIndices[node].size() == 1 ? 0 : cap;
+            for (int n : neighbourIndices[node]) distance = std::min(distance, leafDistance[n] + 1);
+            if (distance < leafDistance[node]) {
+                leafDistance[node] = distance;
+                changed = true;
+            }
+        }
+    }
 }
 
 template<int D>
@@ -187,12 +270,15 @@ void Tree<D>::addParticle(real_t progression) {
     int a = -1;
     int localDensity = -1;
     for (int i = 0; i < specificParams.growthDensitySamples;) {
+        if (youngIndices.empty()) break; // every candidate got rejected
         int potentialYoungIdx = int(rand01() * youngIndices.size());
         int potentialParticle = youngIndices[potentialYoungIdx];
         
-        // Restrict new growth to branch tip proximity
-        if (specificParams.growthMaxLeafDistance > 0 && !isNodeWithinLeafDistance(potentialParticle, specificParams.growthMaxLeafDistance)) {
-            youngIndices.erase(youngIndices.begin() + potentialYoungIdx);
+        // Restrict new growth to branch tip proximity, dropping particles too far from any leaf for good (O(1) deletion, keeping track of the best sample so far)
+        if (specificParams.growthMaxLeafDistance > 0 && leafDistance[potentialParticle] > specificParams.growthMaxLeafDistance) {
+            if (youngIdx == (int)youngIndices.size() - 1) youngIdx = potentialYoungIdx;
+            youngIndices[potentialYoungIdx] = youngIndices.back();
+            youngIndices.pop_back();
             continue;
         }
         
@@ -209,7 +295,7 @@ void Tree<D>::addParticle(real_t progression) {
         }
         ++i;
     }
-    assert(a >= 0);
+    if (a < 0) return; // no particle left that may grow
     
     // pick a random orientation for the young particle
     auto dir = Vec<real_t, D>::RandomUnit(rng);
@@ -217,16 +303,21 @@ void Tree<D>::addParticle(real_t progression) {
     
     // insert new particle
     int newIdx = (int)particles.size();
-    particles.push_back(Particle<D>::FromPosition(particles[a].position + dir));
+    particles.push_back(Particle<D>::FromPosition(particles.getPosition(a) + dir));
     neighbourIndices[a].insert(newIdx);
     neighbourIndices.push_back({ a });
     youngIndices.push_back(newIdx);
+    invalidateVolume();
     addParticleToGrid(newIdx);
+    updateBranchDistances(a, newIdx);
+    if (specificParams.growthMaxLeafDistance > 0) {
+        updateLeafDistances(a);
+    }
     
     // mark parent particle as being too old for new growth with a random probability if the branch is within minBranchLength and maxBranchLength
 	// or if the branch is too small to branch off
 	// on the other hand if the branch is too long, force the node to accept new growth sometime in the future
-	int branchLength = distanceToBranch(newIdx);
+	int branchLength = branchDistance[newIdx];
 	bool allowGrowth =
         progression > specificParams.stopBranchingAfter ?
             false :
@@ -246,34 +337,65 @@ void Tree<D>::addParticle(real_t progression) {
 }
 
 template<int D>
-void Tree<D>::specificJson(std::string& json) {
+void Tree<D>::specificJson(JsonWriter& json) {
     
-    json += "\t'particles': [\n";
+    json.key("particles").beginArray();
     for (std::size_t i = 0; i < particles.size(); ++i) {
-		json += "\t\t{\n";
-		json += "\t\t\t'position': " + particles[i].position.toString() + ",\n";
-		json += "\t\t\t'velocity': " + particles[i].velocity.toString() + ",\n";
-		json += "\t\t\t'acceleration': " + particles[i].acceleration.toString() + ",\n";
-		json += "\t\t\t'noise': 0,\n";
-        json += "\t\t\t'neighbours': [\n";
+		json.beginObject()
+			.field("position", particles.getPosition(i))
+			.field("velocity", particles.getVelocity(i))
+			.field("acceleration", particles.getAcceleration(i))
+			.field("noise", 0)
+			.key("neighbours").beginArray(true);
         for (auto it = neighbourIndices[i].begin(); it != neighbourIndices[i].end(); it++) {
-            json += "\t\t\t\t" + std::to_string(*it) + ",\n";
+            json.value(*it);
         }
-        json = json.substr(0, json.size() - 2) + "\n"; // remove the last ',' inserted
-        json += "\t\t\t],\n";
-		json += "\t\t}";
-		if (i < particles.size() - 1) json += ",";
-		json += "\n";
+		json.endArray().endObject();
     }
-    json += "\t]";
+    json.endArray();
     
 }
 
 template<int D>
-void Tree<D>::specificBinary(bio::BufferedBinaryFileOutput<>& data) {
+void Tree<D>::specificBinary(bio::BufferedBinaryFileOutput<>& data, int version) {
+    
+    if (version >= 6 && snapshotEncoder.enabled()) {
+        // nodes only ever get added as children of existing ones, so the topology comes down to each node's parent: its neighbour of lowest index, if lower than its own (-1 for the root)
+        std::vector<std::int32_t> parents(particles.size());
+        for (std::size_t i = 0; i < particles.size(); ++i) {
+            int parent = *std::min_element(neighbourIndices[i].begin(), neighbourIndices[i].end());
+            parents[i] = parent < int(i) ? parent : -1;
+        }
+        bio::writeSimple<std::uint32_t>(data, 4);
+        snapshotEncoder.beginFrame(data);
+        snapshotEncoder.writePositions(data, particles.position, particles.size());
+        snapshotEncoder.writeEdits(data, "EPAR", 0, parents.data(), parents.size());
+        snapshotEncoder.writeEdits(data, "EYNG", 1, youngIndices.data(), youngIndices.size());
+        return;
+    }
+    
+    if (version >= 6) {
+        // neighbours as compressed rows: the neighbours of i are NBRS[NOFF[i]..NOFF[i + 1]]
+        bio::writeSimple<std::uint32_t>(data, 4);
+        bio::writeColumnHeader<real_t>(data, "POS ", D, particles.size());
+        bio::writeVecs(data, particles.position, particles.size());
+        bio::writeColumnHeader<std::uint32_t>(data, "NOFF", 1, particles.size() + 1);
+        std::uint32_t neighbourCount = 0;
+        bio::writeSimple<std::uint32_t>(data, neighbourCount);
+        for (std::size_t i = 0; i < particles.size(); ++i) {
+            neighbourCount += std::uint32_t(neighbourIndices[i].size());
+            bio::writeSimple<std::uint32_t>(data, neighbourCount);
+        }
+        bio::writeColumnHeader<std::int32_t>(data, "NBRS", 1, neighbourCount);
+        for (std::size_t i = 0; i < particles.size(); ++i) {
+            bio::writeArray<std::int32_t>(data, neighbourIndices[i].begin(), neighbourIndices[i].size());
+        }
+        bio::writeColumn<std::int32_t>(data, "YOUN", youngIndices.data(), 1, youngIndices.size());
+        return;
+    }
     
     for (std::size_t i = 0; i < particles.size(); ++i) {
-        bio::writeVec(data, particles[i].position);
+        bio::writeVec(data, particles.getPosition(i));
         bio::writeCollection(data, neighbourIndices[i]);
     }
 	bio::writeCollection(data, youngIndices);
@@ -281,32 +403,87 @@ void Tree<D>::specificBinary(bio::BufferedBinaryFileOutput<>& data) {
 
 
 // Only consider nodes that are towards the origin when taking backbone dim samples; others are too close to the boundary for comfort
-#define CONSIDER_NODE_D_M(i) (particles[i].position.lengthSqr() < real_t(0.5*0.5))
+#define CONSIDER_NODE_D_M(i) (particles.getPosition(i).lengthSqr() < real_t(0.5*0.5))
 
 template<int D>
-void Tree<D>::backboneDimensionSamples (bio::BufferedBinaryFileOutput<>& data) {
+std::vector<int> Tree<D>::backboneDimensionSources () {
+    std::vector<int> sources;
     for (std::size_t i = 0, sz = particles.size(); i < sz; ++i) {
-        if (CONSIDER_NODE_D_M(i)) {
-            backboneDimensionSample(data, i, -1, i, real_t(0));
-        }
+        if (CONSIDER_NODE_D_M(i)) sources.push_back((int)i);
     }
+    return sources;
 }
 
 template<int D>
-void Tree<D>::backboneDimensionSample (bio::BufferedBinaryFileOutput<>& data, int node, int comingFrom, int originalNode, real_t geodesicDistance) {
-    for (auto it = beginNeighbours(node), end = endNeighbours(node); it != end; it++) {
-        int neighbour = *it;
-        if (neighbour == comingFrom) continue;
-        geodesicDistance += std::sqrt((particles[neighbour].position - particles[node].position).lengthSqr());
+template<typename F>
+void Tree<D>::forEachBackbonePair (int source, std::vector<BackboneStep>& stack, F f) {
+    // neighbours are pushed in reverse so that they pop in order, as the recursive traversal visited them
+    // (each neighbour's geodesic distance is the path length from the source: the current node's distance plus the edge to it)
+    auto sourcePosition = particles.getPosition(source);
+    stack.clear();
+    stack.push_back({ source, -1, real_t(0) });
+    while (!stack.empty()) {
+        BackboneStep step = stack.back();
+        stack.pop_back();
+        auto position = particles.getPosition(step.node);
         
-        if (CONSIDER_NODE_D_M(neighbour)) {
-            real_t euclideanDistance = std::sqrt((particles[neighbour].position - particles[originalNode].position).lengthSqr());
-            bio::writeSimple<real_t>(data, euclideanDistance);
-            bio::writeSimple<real_t>(data, geodesicDistance);
+        if (step.node != source && CONSIDER_NODE_D_M(step.node)) {
+            f(std::sqrt((position - sourcePosition).lengthSqr()), step.geodesicDistance);
         }
         
-        backboneDimensionSample(data, neighbour, node, originalNode, geodesicDistance);
+        for (auto it = endNeighbours(step.node), begin = beginNeighbours(step.node); it != begin;) {
+            int neighbour = *--it;
+            if (neighbour == step.comingFrom) continue;
+            stack.push_back({ neighbour, step.node, step.geodesicDistance + std::sqrt((particles.getPosition(neighbour) - position).lengthSqr()) });
+        }
+    }
+}
+
+template<int D>
+void Tree<D>::backboneDimensionSamples (bio::BufferedBinaryFileOutput<>& data) {
+    // sources are processed in parallel in batches, each into its own buffer, which then get written in order
+    std::vector<int> sources = backboneDimensionSources();
+    const int batchSize = 256;
+    std::vector<std::vector<real_t>> buffers(batchSize); // (euclidean, geodesic) pairs
+    for (int first = 0; first < (int)sources.size(); first += batchSize) {
+        int count = std::min(batchSize, (int)sources.size() - first);
+        #pragma omp parallel
+        {
+            std::vector<BackboneStep> stack;
+            #pragma omp for schedule(dynamic)
+            for (int b = 0; b < count; ++b) {
+                std::vector<real_t>& buffer = buffers[b];
+                buffer.clear();
+                forEachBackbonePair(sources[first + b], stack, [&](real_t euclidean, real_t geodesic) {
+                    buffer.push_back(euclidean);
+                    buffer.push_back(geodesic);
+                });
+            }
+        }
+        for (int b = 0; b < count; ++b) {
+            bio::writeArray(data, buffers[b].data(), buffers[b].size());
+        }
+    }
+}
+
+template<int D>
+BackboneDimensionHistogram Tree<D>::backboneDimensionHistogram () {
+    std::vector<int> sources = backboneDimensionSources();
+    BackboneDimensionHistogram total;
+    #pragma omp parallel
+    {
+        BackboneDimensionHistogram histogram;
+        std::vector<BackboneStep> stack;
+        #pragma omp for schedule(dynamic, 16)
+        for (int s = 0; s < (int)sources.size(); ++s) {
+            forEachBackbonePair(sources[s], stack, [&](real_t euclidean, real_t geodesic) {
+                histogram.add(euclidean, geodesic);
+            });
+        }
+        #pragma omp critical
+        total.merge(histogram);
     }
+    return total;
 }
 
 #undef CONSIDER_NODE_D_M
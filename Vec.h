@@ -110,6 +110,10 @@ WARNING_POP;
 	inline T setZ (const T& val) { return set(2, val); }
 	inline T setW (const T& val) { return set(3, val); }
 
+	// Raw access to the components (e.g. for atomic updates of a single component)
+	inline T* data() { return components; }
+	inline const T* data() const { return components; }
+
 	// Swizzle setters (2- and 3-components only; all possible permutations of x, y, z, w)
 #define SWIZ2(a, b)			inline void set ## a ## b		(const Vec<T, 2>& v)	{ set ## a (v[0]); set ## b (v[1]); }
 #define SWIZ3(a, b, c)		inline void set ## a ## b ## c	(const Vec<T, 3>& v)	{ set ## a (v[0]); set ## b (v[1]); set ## c (v[2]); }
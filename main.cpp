@@ -3,6 +3,7 @@
 #include "Options.h"
 #include "SurfaceFactory.h"
 #include "File.h"
+#include "JsonWriter.h"
 #ifdef _OPENMP
 	#include <omp.h>
 #endif
@@ -23,7 +24,12 @@ int main(int argc, char** argv) {
 	int iterations;
 	int particleGrowth;
 	bool writeJson;
+	int asyncOutputFrames;
+	int binaryVersion;
+	real_t quantum;
+	int keyframeInterval;
     bool computeBackboneDim = false;
+    BackboneDimensionMode backboneDimMode = BackboneDimensionMode::RAW;
 	std::string outFile;
 	{
 		Arguments args(argc, argv);
@@ -31,10 +37,33 @@ int main(int argc, char** argv) {
 		surface = SurfaceFactory::build(args, sealPreset);
         if (surface->isTree()) {
             computeBackboneDim = args.read<bool>("compute-backbone-dim", false);
+            std::string mode = args.read<std::string>("backbone-dim-mode", "raw");
+            if (mode.compare("histogram") == 0) {
+                backboneDimMode = BackboneDimensionMode::HISTOGRAM;
+            } else if (mode.compare("slope") == 0) {
+                backboneDimMode = BackboneDimensionMode::SLOPE;
+            } else if (mode.compare("raw") == 0) {
+                backboneDimMode = BackboneDimensionMode::RAW;
+            } else {
+                std::printf("Unknown backbone dimension mode %s (should be raw|histogram|slope), aborting.\n", mode.c_str());
+                std::exit(1);
+            }
         }
 		iterations = args.read<int>("iter", sealPreset ? 20000 : 600);
 		particleGrowth = args.read<int>("growth", 5);
 		writeJson = args.read<bool>("json", false);
+		asyncOutputFrames = args.read<int>("async-output", 2); // snapshots waiting for the writer thread at most, 0 to write them synchronously
+		binaryVersion = args.read<int>("format", 5); // 6 for columnar frames, followed by a frame index
+		if (binaryVersion != 5 && binaryVersion != 6) {
+			std::printf("Unknown binary format %d (should be 5 or 6), aborting.\n", binaryVersion);
+			std::exit(1);
+		}
+		quantum = args.read<real_t>("quantize", real_t(0)); // if > 0, v6 snapshots get compact encoding, with positions rounded to multiples of this
+		keyframeInterval = args.read<int>("keyframe-interval", 32); // with -quantize, snapshots between full ones
+		if (quantum > 0 && binaryVersion < 6) {
+			std::printf("-quantize needs -format 6, aborting.\n");
+			std::exit(1);
+		}
 		std::string allArgs = "";
 		for (int i = 1; i < argc; ++i) {
 			allArgs += argv[i] + std::string(" ");
@@ -60,9 +89,15 @@ int main(int argc, char** argv) {
 	
 	std::printf("Starting...\n\n");
 	
-	std::string snapshotsJson = writeJson ? "[\n" : "";
+	if (quantum > 0) {
+		surface->setCompactBinary(quantum, keyframeInterval);
+	}
 	bio::BufferedBinaryFileOutput<> snapshotsBinary(outFile);
-	bool first = true;
+	snapshotsBinary.setAsynchronous(std::size_t(std::max(0, asyncOutputFrames)));
+	std::vector<std::uint64_t> frameOffsets; // where each snapshot starts in the file, for the v6 frame index
+	std::unique_ptr<JsonArrayFile> snapshotsJson; // each snapshot gets appended to the file as it is taken
+	JsonWriter json;
+	if (writeJson) snapshotsJson = std::make_unique<JsonArrayFile>("results/surface.json");
 
 	// grow progressively
 	long long totalRuntimeMs;
@@ -84,14 +119,13 @@ int main(int argc, char** argv) {
 					std::printf("%d %%...\r", t * 100 / iterations);
 					std::fflush(stdout);
 					auto millis = runtime.getMs();
-					surface->toBinary(int(millis), snapshotsBinary);
+					frameOffsets.push_back(snapshotsBinary.offset());
+					surface->toBinary(int(millis), snapshotsBinary, binaryVersion);
+					snapshotsBinary.endFrame();
 					if (writeJson) {
-						if (!first) {
-							snapshotsJson += ",\n";
-						}
-						snapshotsJson += surface->toJson(int(millis));
-						first = false;
-						File::Write("results/surface.json", snapshotsJson + "\n]");
+						json.clear();
+						surface->toJson(int(millis), json);
+						snapshotsJson->append(json.str());
 					}
 				}
 			#endif
@@ -107,12 +141,17 @@ int main(int argc, char** argv) {
 	}
 	
 	// Write the final snapshot
-	surface->toBinary(int(totalRuntimeMs), snapshotsBinary);
-	snapshotsBinary.dump();
+	frameOffsets.push_back(snapshotsBinary.offset());
+	surface->toBinary(int(totalRuntimeMs), snapshotsBinary, binaryVersion);
+	if (binaryVersion >= 6) {
+		bio::writeFrameIndex(snapshotsBinary, frameOffsets, std::uint8_t(binaryVersion));
+	}
+	snapshotsBinary.flush();
 	std::printf("Wrote results to %s", outFile.c_str());
 	if (writeJson) {
-		snapshotsJson += (first ? "" : ",\n") + surface->toJson(int(totalRuntimeMs));
-		File::Write("results/surface.json", snapshotsJson + "\n]");
+		json.clear();
+		surface->toJson(int(totalRuntimeMs), json);
+		snapshotsJson->append(json.str());
 		std::printf(" and results/surface.json");
 	}
 	std::printf(".\n");
@@ -120,16 +159,27 @@ int main(int argc, char** argv) {
     // Compute the backbone dimension in-place if required
     if (computeBackboneDim) {
         std::printf("Computing backbone dimension...\n");
-	    bio::BufferedBinaryFileOutput<> backboneDimBinary(outFile + ".d_m");
-        if (surface->getDimension() == 2) {
-            Tree<2>* tree = dynamic_cast<Tree<2>*>(surface);
-            tree->backboneDimensionSamples(backboneDimBinary);
-        } else if (surface->getDimension() == 3) {
-            Tree<3>* tree = dynamic_cast<Tree<3>*>(surface);
-            tree->backboneDimensionSamples(backboneDimBinary);
+        Tree<2>* tree2 = surface->getDimension() == 2 ? dynamic_cast<Tree<2>*>(surface) : nullptr;
+        Tree<3>* tree3 = surface->getDimension() == 3 ? dynamic_cast<Tree<3>*>(surface) : nullptr;
+        if (backboneDimMode == BackboneDimensionMode::RAW) {
+            bio::BufferedBinaryFileOutput<> backboneDimBinary(outFile + ".d_m");
+            if (tree2) tree2->backboneDimensionSamples(backboneDimBinary);
+            if (tree3) tree3->backboneDimensionSamples(backboneDimBinary);
+            backboneDimBinary.dump();
+            std::printf("Wrote backbone dimension samples to %s.d_m.\n", outFile.c_str());
+        } else {
+            BackboneDimensionHistogram histogram = tree2 ? tree2->backboneDimensionHistogram() : tree3->backboneDimensionHistogram();
+            std::printf("Backbone dimension: %f (%.0f samples).\n", histogram.slope(), histogram.n);
+            if (backboneDimMode == BackboneDimensionMode::HISTOGRAM) {
+                bio::BufferedBinaryFileOutput<> histogramBinary(outFile + ".d_m_hist");
+                histogram.write(histogramBinary);
+                histogramBinary.dump();
+                std::printf("Wrote backbone dimension histogram to %s.d_m_hist.\n", outFile.c_str());
+            } else {
+                File::Write(outFile + ".d_m.txt", std::to_string(histogram.slope()) + "\n");
+                std::printf("Wrote backbone dimension to %s.d_m.txt.\n", outFile.c_str());
+            }
         }
-        backboneDimBinary.dump();
-        std::printf("Wrote backbone dimension samples to %s.d_m.\n", outFile.c_str());
     }
     
 	delete surface;
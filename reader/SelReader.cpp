@@ -0,0 +1,341 @@
+#include "SelReader.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <algorithm>
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+
+sel::MappedFile::MappedFile(const std::string& filename) {
+#ifdef _WIN32
+	file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	LARGE_INTEGER fileSize;
+	if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &fileSize)) {
+		std::printf("File %s could not be open for reading, aborting.\n", filename.c_str());
+		std::exit(1);
+	}
+	length = std::size_t(fileSize.QuadPart);
+	if (length == 0) return;
+	mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	bytes = mapping ? static_cast<const std::uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+#else
+	int fd = open(filename.c_str(), O_RDONLY);
+	struct stat status;
+	if (fd < 0 || fstat(fd, &status) != 0) {
+		std::printf("File %s could not be open for reading, aborting.\n", filename.c_str());
+		std::exit(1);
+	}
+	length = std::size_t(status.st_size);
+	if (length == 0) {
+		close(fd);
+		return;
+	}
+	void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); // the mapping stays valid without the descriptor
+	bytes = mapped == MAP_FAILED ? nullptr : static_cast<const std::uint8_t*>(mapped);
+#endif
+	if (!bytes) {
+		std::printf("File %s could not be mapped to memory, aborting.\n", filename.c_str());
+		std::exit(1);
+	}
+}
+
+sel::MappedFile::~MappedFile() {
+#ifdef _WIN32
+	if (bytes) UnmapViewOfFile(bytes);
+	if (mapping) CloseHandle(mapping);
+	if (file && file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+	if (bytes) munmap(const_cast<std::uint8_t*>(bytes), length);
+#endif
+}
+
+
+namespace {
+
+	/// Bounds-checked reading of a mapped file, that stops reading anything (and turns ok to false) upon running past its end
+	struct Cursor {
+		const std::uint8_t* data;
+		std::size_t size;
+		std::size_t at;
+		bool ok = true;
+
+		inline bool has(std::uint64_t count) {
+			ok = ok && count <= size - at;
+			return ok;
+		}
+
+		inline void skip(std::uint64_t count) {
+			if (has(count)) at += std::size_t(count);
+		}
+
+		template<typename T>
+		inline T read() {
+			T value{};
+			if (has(sizeof(T))) {
+				std::memcpy(&value, data + at, sizeof(T));
+				at += sizeof(T);
+			}
+			return value;
+		}
+
+		inline std::string readString() {
+			const void* end = ok ? std::memchr(data + at, 0, size - at) : nullptr;
+			if (!end) {
+				ok = false;
+				return "";
+			}
+			std::size_t length = std::size_t(static_cast<const std::uint8_t*>(end) - (data + at));
+			std::string s(reinterpret_cast<const char*>(data + at), length);
+			at += length + 1;
+			return s;
+		}
+	};
+
+	inline std::size_t columnTypeSize(bio::ColumnType type) {
+		return type == bio::ColumnType::FLOAT64 ? 8 : type == bio::ColumnType::UINT8 ? 1 : 4;
+	}
+
+}
+
+bool sel::SnapshotFile::parse(std::uint64_t offset, Frame& frame) const {
+	if (offset > file.size()) return false;
+	Cursor c = { file.data(), file.size(), std::size_t(offset) };
+	if (!c.has(5) || std::memcmp(file.data() + offset, "SEL", 3) != 0) return false;
+	c.skip(3);
+
+	// Metadata, laid out the same in all versions
+	frame.version = c.read<std::uint8_t>();
+	if (frame.version != 5 && frame.version != 6) return false;
+	frame.dimension = c.read<std::uint8_t>();
+	frame.hint = c.readString();
+	frame.date = c.read<std::int64_t>();
+	frame.machine = c.readString();
+	frame.seed = c.read<std::int32_t>();
+	frame.timesteps = c.read<std::int32_t>();
+	c.skip(4 * sizeof(float)); // attraction magnitude, repulsion factor, damping, noise
+	c.skip(frame.dimension * sizeof(float)); // repulsion anisotropy
+	c.skip(sizeof(float)); // dt
+	frame.runtimeMs = c.read<std::int32_t>();
+	frame.volume = c.read<float>();
+	if (c.read<std::int8_t>() != 0) {
+		std::int8_t boundaryType = c.read<std::int8_t>();
+		if (boundaryType == 0) c.skip(2 * sizeof(float) + 1); // sphere: radius, extent, offset flag
+		else if (boundaryType == 1) c.skip(2 * sizeof(float)); // cylinder: radius, extent
+		else return false;
+	}
+	frame.particleCount = c.read<std::int32_t>();
+	if (!c.ok || frame.particleCount < 0) return false;
+	frame.metadataSize = c.at - std::size_t(offset);
+
+	// Particle data
+	std::uint64_t n = std::uint64_t(frame.particleCount);
+	std::uint64_t positionBytes = frame.dimension * sizeof(float);
+	frame.columns.clear();
+	if (frame.version == 5) {
+		// particle by particle, as written by each model's specificBinary
+		if (frame.hint == "s2") {
+			c.skip(n * (positionBytes + 4));
+		} else if (frame.hint == "s3") {
+			c.skip(n * positionBytes);
+			c.skip(std::uint64_t(std::uint32_t(c.read<std::int32_t>())) * 12);
+		} else if (!frame.hint.empty() && frame.hint[0] == 't') {
+			for (std::uint64_t i = 0; i < n && c.ok; ++i) {
+				c.skip(positionBytes);
+				c.skip(std::uint64_t(c.read<std::uint32_t>()) * 4);
+			}
+			c.skip(std::uint64_t(c.read<std::uint32_t>()) * 4);
+		} else {
+			return false;
+		}
+	} else {
+		std::uint32_t columnCount = c.read<std::uint32_t>();
+		for (std::uint32_t k = 0; k < columnCount && c.ok; ++k) {
+			c.skip((bio::ColumnAlignment - c.at % bio::ColumnAlignment) % bio::ColumnAlignment);
+			RawColumn column;
+			if (!c.has(4)) return false;
+			std::memcpy(column.name, file.data() + c.at, 4);
+			c.skip(4);
+			std::uint8_t type = c.read<std::uint8_t>();
+			if (type > std::uint8_t(bio::ColumnType::UINT8)) return false;
+			column.type = bio::ColumnType(type);
+			column.components = c.read<std::uint8_t>();
+			c.skip(2);
+			column.count = c.read<std::uint64_t>();
+			if (!c.ok || column.count > file.size()) return false; // before multiplying, so that a corrupt count can't overflow
+			column.values = file.data() + c.at;
+			c.skip(column.count * std::uint64_t(column.components) * columnTypeSize(column.type));
+			frame.columns.push_back(column);
+		}
+	}
+
+	// EOS
+	if (c.read<std::uint8_t>() != 0 || !c.ok) return false;
+	frame.begin = file.data() + offset;
+	frame.size = c.at - std::size_t(offset);
+	return true;
+}
+
+sel::SnapshotFile::SnapshotFile(const std::string& filename) : file(filename) {
+	// v6 index footer: frame count (u64), "SELI", version, padding
+	const std::uint8_t* data = file.data();
+	std::size_t size = file.size();
+	if (size < 16 || std::memcmp(data + size - 8, "SELI", 4) != 0) return;
+	std::uint64_t count;
+	std::memcpy(&count, data + size - 16, sizeof(count));
+	if (count > (size - 16) / sizeof(std::uint64_t)) return;
+	offsets.resize(std::size_t(count));
+	std::memcpy(offsets.data(), data + size - 16 - count * sizeof(std::uint64_t), std::size_t(count) * sizeof(std::uint64_t));
+	for (std::uint64_t offset : offsets) {
+		if (offset >= size) {
+			// not a usable index after all, walk the file instead
+			offsets.clear();
+			return;
+		}
+	}
+	indexed = complete = true;
+}
+
+void sel::SnapshotFile::findFrame(std::size_t k) {
+	Frame frame;
+	while (!complete && offsets.size() <= k) {
+		// frames may be preceded by a few bytes of padding (see extract)
+		std::uint64_t offset = walkedTo;
+		while (offset < file.size() && offset < walkedTo + bio::ColumnAlignment && file.data()[offset] == 0) ++offset;
+		if (!parse(offset, frame)) {
+			complete = true; // end of the file, or whatever follows the last complete frame (index, interrupted write)
+			break;
+		}
+		offsets.push_back(offset);
+		walkedTo = offset + frame.size;
+	}
+}
+
+std::size_t sel::SnapshotFile::frameCount() {
+	findFrame(std::numeric_limits<std::size_t>::max());
+	return offsets.size();
+}
+
+sel::Frame sel::SnapshotFile::frame(std::size_t k) {
+	findFrame(k);
+	if (k >= offsets.size()) {
+		std::printf("Frame %zu requested, but the file only has %zu frames, aborting.\n", k, offsets.size());
+		std::exit(1);
+	}
+	Frame frame;
+	if (!parse(offsets[k], frame)) {
+		std::printf("Frame %zu could not be read, aborting.\n", k);
+		std::exit(1);
+	}
+	return frame;
+}
+
+sel::DecodedFrame sel::SnapshotFile::decode(std::size_t k) {
+	Frame last = frame(k);
+	if (!last.isCompact()) {
+		std::printf("Frame %zu doesn't have compact encoding, aborting.\n", k);
+		std::exit(1);
+	}
+	std::size_t keyDistance = last.column<std::uint32_t>("KEYD")[0][0];
+	if (keyDistance > k) {
+		std::printf("Frame %zu refers to a keyframe before the start of the file, aborting.\n", k);
+		std::exit(1);
+	}
+	DecodedFrame decoded;
+	for (std::size_t j = k - keyDistance; j <= k; ++j) {
+		Frame f = j == k ? last : frame(j);
+		bool ok = f.isCompact() && (j > k - keyDistance || f.column<std::uint32_t>("KEYD")[0][0] == 0);
+		for (const RawColumn& c : f.columns) {
+			if (!ok || c.type != bio::ColumnType::UINT8) continue;
+			const std::uint8_t* end = c.values + c.count;
+			if (std::memcmp(c.name, "QPOS", 4) == 0) {
+				ok = delta::decodePositions(c.values, end, f.dimension, std::size_t(f.particleCount), decoded.quantum, decoded.quantized);
+				continue;
+			}
+			std::string name(c.name, 4);
+			auto column = std::find_if(decoded.columns.begin(), decoded.columns.end(), [&](const auto& d) { return d.first == name; });
+			if (column == decoded.columns.end()) column = decoded.columns.insert(column, { name, {} });
+			ok = delta::decodeEdits(c.values, end, column->second);
+		}
+		if (!ok) {
+			std::printf("Frame %zu could not be decoded, aborting.\n", j);
+			std::exit(1);
+		}
+	}
+	decoded.positions.resize(decoded.quantized.size());
+	for (std::size_t v = 0; v < decoded.quantized.size(); ++v) {
+		decoded.positions[v] = float(double(decoded.quantized[v]) * double(decoded.quantum));
+	}
+	return decoded;
+}
+
+void sel::SnapshotFile::extract(const std::vector<std::size_t>& frames, const std::string& filename) {
+	bio::BufferedBinaryFileOutput<> out(filename);
+	std::vector<std::uint64_t> newOffsets;
+	bool allColumnar = !frames.empty();
+	std::vector<std::uint8_t> bytes;
+	bool hasPrevious = false;
+	std::size_t previous = 0;
+	std::uint32_t keyDistance = 0; // of the last compact frame written
+	for (std::size_t k : frames) {
+		Frame f = frame(k);
+		bool follows = hasPrevious && previous == k - 1;
+		hasPrevious = true;
+		previous = k;
+		if (f.isCompact() && !follows && f.column<std::uint32_t>("KEYD")[0][0] > 0) {
+			// the frames it was encoded against are missing, write it as a keyframe
+			DecodedFrame decoded = decode(k);
+			newOffsets.push_back(out.offset());
+			bio::writeBytes(out, f.begin, f.metadataSize);
+			bio::writeSimple<std::uint32_t>(out, std::uint32_t(f.columns.size()));
+			keyDistance = 0;
+			bio::writeColumn<std::uint32_t>(out, "KEYD", &keyDistance, 1, 1);
+			for (const RawColumn& c : f.columns) {
+				if (c.type != bio::ColumnType::UINT8) continue;
+				bytes.clear();
+				if (std::memcmp(c.name, "QPOS", 4) == 0) {
+					delta::encodePositions(bytes, decoded.quantum, {}, decoded.quantized, f.dimension);
+				} else {
+					const std::vector<std::int32_t>& values = *decoded.column(std::string(c.name, 4).c_str());
+					delta::encodeEdits(bytes, {}, values.data(), values.size());
+				}
+				bio::writeColumn<std::uint8_t>(out, c.name, bytes.data(), 1, bytes.size());
+			}
+			out.push_back(0); // EOS
+			continue;
+		}
+		if (f.version >= 6) {
+			// columns are aligned relative to the start of the file, so the frame has to keep its offset modulo the alignment
+			std::uint64_t from = std::uint64_t(f.begin - file.data());
+			while (out.offset() % bio::ColumnAlignment != from % bio::ColumnAlignment) out.push_back(0);
+		} else {
+			allColumnar = false;
+		}
+		newOffsets.push_back(out.offset());
+		if (f.isCompact()) {
+			// copied as is, apart from the distance to its keyframe, which may now be shorter
+			ColumnView<std::uint32_t> key = f.column<std::uint32_t>("KEYD");
+			keyDistance = key[0][0] == 0 ? 0 : keyDistance + 1;
+			const std::uint8_t* keyBytes = reinterpret_cast<const std::uint8_t*>(key.values);
+			bio::writeBytes(out, f.begin, std::size_t(keyBytes - f.begin));
+			bio::writeSimple<std::uint32_t>(out, keyDistance);
+			bio::writeBytes(out, keyBytes + sizeof(std::uint32_t), f.size - std::size_t(keyBytes - f.begin) - sizeof(std::uint32_t));
+		} else {
+			bio::writeBytes(out, f.begin, f.size);
+		}
+	}
+	if (allColumnar) {
+		bio::writeFrameIndex(out, newOffsets, 6);
+	}
+}
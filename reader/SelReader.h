@@ -0,0 +1,162 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../BinaryIO.h"
+#include "../DeltaEncoding.h"
+
+///
+/// Reading of the binary snapshot files (.bin) written by seals, straight from a memory mapping of the file
+/// Frames are only located and parsed when asked for; with the frame index of SEL v6 files, any frame is found in constant time,
+/// while other files (SEL v5, or v6 runs that were interrupted before writing their index) get walked frame by frame as far as needed
+/// The columns of v6 frames are exposed as typed views into the mapping, without copying anything
+///
+
+namespace sel {
+
+	/// Read-only memory mapping of a whole file
+	class MappedFile {
+	private:
+		const std::uint8_t* bytes = nullptr;
+		std::size_t length = 0;
+	#ifdef _WIN32
+		void* file = nullptr;
+		void* mapping = nullptr;
+	#endif
+
+	public:
+
+		/// Maps the file, aborting if it can't be read
+		MappedFile(const std::string& filename);
+		~MappedFile();
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		inline const std::uint8_t* data() const { return bytes; }
+		inline std::size_t size() const { return length; }
+
+	}; // MappedFile
+
+
+	/// Column of a v6 frame as found in the file (see bio::writeColumnHeader), before picking a type for its values
+	struct RawColumn {
+		char name[5] = {};
+		bio::ColumnType type = bio::ColumnType::FLOAT32;
+		int components = 0; // values per element
+		std::uint64_t count = 0; // elements
+		const std::uint8_t* values = nullptr;
+	};
+
+	/// Typed view of a column's values, pointing into the mapped file
+	/// Element i is made of the components values starting at (*this)[i]; an empty view (values == nullptr) stands for a missing column
+	template<typename T>
+	struct ColumnView {
+		const T* values = nullptr;
+		std::size_t count = 0;
+		int components = 0;
+
+		inline bool empty() const { return values == nullptr; }
+		inline std::size_t size() const { return count; }
+		inline const T* operator[](std::size_t i) const { return values + i * components; }
+	};
+
+	/// One snapshot, with its metadata parsed and its particle data left in place
+	struct Frame {
+		const std::uint8_t* begin = nullptr; // "SEL" tag
+		std::size_t size = 0; // bytes from the tag to the end of stream marker included
+		std::size_t metadataSize = 0; // bytes from the tag to the particle data (column count for v6)
+
+		int version = 0;
+		int dimension = 0;
+		std::string hint; // "s2", "s3", "t2" or "t3"
+		std::int64_t date = 0;
+		std::string machine;
+		int seed = 0;
+		int timesteps = 0;
+		int runtimeMs = 0;
+		float volume = 0;
+		int particleCount = 0;
+		std::vector<RawColumn> columns; // v6 only
+
+		/// View of the named column (4 characters, e.g. "POS "), or an empty view if the frame has no such column or it holds another type
+		template<typename T>
+		ColumnView<T> column(const char* name) const {
+			ColumnView<T> view;
+			for (const RawColumn& c : columns) {
+				if (std::memcmp(c.name, name, 4) != 0 || c.type != bio::ColumnTypeOf<T>::value) continue;
+				view.values = reinterpret_cast<const T*>(c.values);
+				view.count = std::size_t(c.count);
+				view.components = c.components;
+			}
+			return view;
+		}
+
+		/// Particle positions (dimension floats per particle)
+		inline ColumnView<float> positions() const { return column<float>("POS "); }
+
+		/// Whether the frame's particle data has compact encoding (see DeltaEncoding.h), to be read through SnapshotFile::decode
+		inline bool isCompact() const { return !column<std::uint32_t>("KEYD").empty(); }
+
+	}; // Frame
+
+	/// Particle data of a compactly encoded frame, decoded
+	struct DecodedFrame {
+		float quantum = 0;
+		std::vector<std::int32_t> quantized; // positions / quantum, dimension values per particle
+		std::vector<float> positions; // same, dimension floats per particle
+		std::vector<std::pair<std::string, std::vector<std::int32_t>>> columns; // values of the edited columns (ENXT, ETRI, EPAR, EYNG...)
+
+		/// Values of the named column, or nullptr if there is no such column
+		const std::vector<std::int32_t>* column(const char* name) const {
+			for (const auto& c : columns) {
+				if (c.first.compare(0, 4, name) == 0) return &c.second;
+			}
+			return nullptr;
+		}
+	};
+
+	/// A .bin file of consecutive frames
+	class SnapshotFile {
+	private:
+		MappedFile file;
+		std::vector<std::uint64_t> offsets; // offsets of the frames found so far
+		bool indexed = false; // whether offsets came complete from the file's index
+		bool complete = false; // whether all frames have been found
+		std::uint64_t walkedTo = 0; // end of the last frame found by walking the file
+
+		/// Parses the frame starting at the given offset into frame, returning false if there isn't a complete one there
+		bool parse(std::uint64_t offset, Frame& frame) const;
+
+		/// Walks on from the last frame found until frame k is found too, or the end of the file
+		void findFrame(std::size_t k);
+
+	public:
+
+		/// Maps the file, and reads its frame index if it has one
+		SnapshotFile(const std::string& filename);
+
+		/// Whether frames are located through the file's index rather than by walking the file
+		inline bool hasIndex() const { return indexed; }
+
+		inline const MappedFile& mapping() const { return file; }
+
+		/// Number of frames, walking the whole file the first time if it has no index
+		std::size_t frameCount();
+
+		/// Frame k, which must be less than frameCount()
+		Frame frame(std::size_t k);
+
+		/// Decodes frame k, which must have compact encoding, replaying frames from the last keyframe before it
+		DecodedFrame decode(std::size_t k);
+
+		/// Writes the given frames, in that order, to a new file; with v6 frames, alignment gets preserved and the new file gets its own index
+		/// Compactly encoded frames are written as keyframes, unless they follow the frame before them
+		void extract(const std::vector<std::size_t>& frames, const std::string& filename);
+
+	}; // SnapshotFile
+
+}
@@ -0,0 +1,118 @@
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include "SelReader.h"
+#include "../Arguments.h"
+
+
+/// Parses a frame selection such as "0,10,20-30,last" into frame indices
+std::vector<std::size_t> parseFrames(const std::string& selection, std::size_t frameCount) {
+	std::vector<std::size_t> frames;
+	auto usage = [&]() {
+		std::printf("Invalid frame selection '%s' (expected comma-separated frames or first-last ranges, e.g. 0,10,20-30,last), aborting.\n", selection.c_str());
+		std::exit(1);
+	};
+	auto resolve = [&](const std::string& token) {
+		long long k = (long long)frameCount - 1;
+		if (token.compare("last") != 0) {
+			std::size_t parsed = 0;
+			try {
+				k = std::stoll(token, &parsed);
+			} catch (const std::logic_error&) { // std::invalid_argument or std::out_of_range
+				usage();
+			}
+			if (parsed != token.size()) usage();
+		}
+		if (k < 0 || k >= (long long)frameCount) {
+			std::printf("Frame %s is out of range (the file has %zu frames), aborting.\n", token.c_str(), frameCount);
+			std::exit(1);
+		}
+		return std::size_t(k);
+	};
+	std::size_t start = 0;
+	while (start < selection.size()) {
+		std::size_t end = selection.find(',', start);
+		if (end == std::string::npos) end = selection.size();
+		std::string token = selection.substr(start, end - start);
+		std::size_t dash = token.find('-');
+		if (dash == std::string::npos) {
+			frames.push_back(resolve(token));
+		} else {
+			std::size_t first = resolve(token.substr(0, dash)), last = resolve(token.substr(dash + 1));
+			if (first > last) {
+				std::printf("Frame range %s is reversed (should be first-last), aborting.\n", token.c_str());
+				std::exit(1);
+			}
+			for (std::size_t k = first; k <= last; ++k) frames.push_back(k);
+		}
+		start = end + 1;
+	}
+	return frames;
+}
+
+void printFrame(sel::SnapshotFile& file, std::size_t k, int particles) {
+	sel::Frame frame = file.frame(k);
+	std::printf("SEL v%d, %s (%dD), seed %d, timestep %d, runtime %d ms, volume %g, %d particles, %zu bytes\n",
+		frame.version, frame.hint.c_str(), frame.dimension, frame.seed, frame.timesteps, frame.runtimeMs, frame.volume, frame.particleCount, frame.size);
+	if (frame.version < 6) {
+		std::printf("Particle data of v%d frames isn't columnar; write the file with -format 6 to get views of it.\n", frame.version);
+		return;
+	}
+	static const char* typeNames[] = { "float32", "float64", "int32", "uint32", "uint8" };
+	for (const sel::RawColumn& column : frame.columns) {
+		std::printf("  column '%s': %llu x %d %s\n", column.name, (unsigned long long)column.count, column.components, typeNames[int(column.type)]);
+	}
+	if (frame.isCompact()) {
+		sel::DecodedFrame decoded = file.decode(k);
+		std::printf("  decoded with quantum %g:", decoded.quantum);
+		for (const auto& column : decoded.columns) std::printf(" '%s' x %zu", column.first.c_str(), column.second.size());
+		std::printf("\n");
+		for (int i = 0; i < particles && i < frame.particleCount; ++i) {
+			std::printf("  %d:", i);
+			for (int a = 0; a < frame.dimension; ++a) std::printf(" %g", decoded.positions[i * frame.dimension + a]);
+			std::printf("\n");
+		}
+		return;
+	}
+	sel::ColumnView<float> positions = frame.positions();
+	for (int i = 0; i < particles && std::size_t(i) < positions.size(); ++i) {
+		std::printf("  %d:", i);
+		for (int a = 0; a < positions.components; ++a) std::printf(" %g", positions[i][a]);
+		std::printf("\n");
+	}
+}
+
+
+int main(int argc, char** argv) {
+
+	// Read arguments
+	std::string inFile, outFile, extract;
+	std::string frameIndex;
+	int particles;
+	{
+		Arguments args(argc, argv);
+		inFile = args.read<std::string>("in");
+		frameIndex = args.read<std::string>("frame", "last"); // frame to print (unless -extract is given)
+		particles = args.read<int>("particles", 10); // particles to print along with the frame
+		extract = args.read<std::string>("extract", ""); // frames to copy to -out, e.g. 0,10,20-30,last
+		outFile = args.read<std::string>("out", extract.empty() ? "" : inFile + ".extract.bin");
+	}
+
+	sel::SnapshotFile file(inFile);
+	std::size_t frameCount = file.frameCount();
+	std::printf("%s: %zu frames, %zu bytes%s.\n", inFile.c_str(), frameCount, file.mapping().size(), file.hasIndex() ? " (indexed)" : "");
+	if (frameCount == 0) return 0;
+
+	if (!extract.empty()) {
+		std::vector<std::size_t> frames = parseFrames(extract, frameCount);
+		file.extract(frames, outFile);
+		std::printf("Wrote %zu frames to %s.\n", frames.size(), outFile.c_str());
+		return 0;
+	}
+
+	printFrame(file, parseFrames(frameIndex, frameCount)[0], particles);
+
+	return 0;
+}
@@ -0,0 +1,65 @@
+#include <cstdio>
+#include <array>
+#include <vector>
+
+#include "../HashGrid.h"
+
+
+/// Checks for HashGrid, built with `make test`
+/// Exits with 1 if any check fails
+
+static int failures = 0;
+
+static void check(bool condition, const char* what) {
+	if (!condition) {
+		std::printf("FAILED: %s\n", what);
+		++failures;
+	}
+}
+
+/// Number of values returned by sample() around pos, across all 3^D neighbouring cells
+template<int D>
+static int sampledCount(HashGrid<D>& grid, const Vec<real_t, D>& pos) {
+	std::array<CellRange, powConstexpr(3, D)> neighbours;
+	grid.sample(pos, neighbours);
+	int count = 0;
+	for (const CellRange& range : neighbours) count += range.size();
+	return count;
+}
+
+/// Particles clustered in cells with negative coordinates, including the cell at -1 along every axis
+template<int D>
+static void negativeCells(const char* name) {
+	const std::vector<real_t> offsets = { real_t(-.51), real_t(-.52), real_t(-.55), real_t(-.58) };
+	std::array<std::vector<real_t>, D> position;
+	for (real_t offset : offsets) {
+		for (int a = 0; a < D; ++a) position[a].push_back(offset);
+	}
+	Vec<real_t, D> centre;
+	for (int a = 0; a < D; ++a) centre.set(a, real_t(-.53));
+
+	HashGrid<D> built(real_t(.1));
+	built.build(position, int(offsets.size()));
+	std::printf("%s build: %d of %d\n", name, sampledCount(built, centre), int(offsets.size()));
+	check(sampledCount(built, centre) == int(offsets.size()), "build() in negative cells");
+
+	HashGrid<D> added(real_t(.1));
+	for (std::size_t i = 0; i < offsets.size(); ++i) {
+		Vec<real_t, D> pos;
+		for (int a = 0; a < D; ++a) pos.set(a, position[a][i]);
+		added.add(pos, int(i));
+	}
+	std::printf("%s add: %d of %d\n", name, sampledCount(added, centre), int(offsets.size()));
+	check(sampledCount(added, centre) == int(offsets.size()), "add() in negative cells");
+}
+
+int main() {
+	negativeCells<2>("2D");
+	negativeCells<3>("3D");
+	if (failures > 0) {
+		std::printf("%d check(s) failed.\n", failures);
+		return 1;
+	}
+	std::printf("All checks passed.\n");
+	return 0;
+}
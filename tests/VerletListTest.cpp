@@ -0,0 +1,79 @@
+#include <cstdio>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "../SurfaceFactory.h"
+
+
+/// Checks that Verlet lists (-verlet-skin) give the same forces as the plain grid, built with `make test`
+/// Exits with 1 if any check fails
+
+static int failures = 0;
+
+static void check(bool condition, const char* what) {
+	if (!condition) {
+		std::printf("FAILED: %s\n", what);
+		++failures;
+	}
+}
+
+/// Builds a surface from command-line style arguments and grows it for a number of steps, returning its particles
+template<typename T, int D>
+static ParticleStore<D> grow(std::vector<std::string> arguments, int steps) {
+	std::vector<char*> argv = { const_cast<char*>("test") };
+	for (std::string& argument : arguments) argv.push_back(&argument[0]);
+	SurfaceBase<>* surface;
+	{
+		Arguments args(int(argv.size()), argv.data());
+		surface = SurfaceFactory::build(args, false);
+	}
+	for (int t = 0; t < steps; ++t) {
+		if (t % 5 == 0) surface->addParticle(real_t(t) / real_t(steps));
+		surface->update(real_t(t) / real_t(steps));
+	}
+	ParticleStore<D> particles = dynamic_cast<T*>(surface)->getParticles();
+	delete surface;
+	return particles;
+}
+
+/// Largest difference in acceleration between two runs, relative to the largest acceleration
+template<int D>
+static double accelerationDifference(const ParticleStore<D>& a, const ParticleStore<D>& b) {
+	if (a.size() != b.size()) return INFINITY;
+	double difference = 0, scale = 0;
+	for (int axis = 0; axis < D; ++axis) for (std::size_t i = 0; i < a.size(); ++i) {
+		difference = std::max(difference, std::abs(double(a.acceleration[axis][i]) - double(b.acceleration[axis][i])));
+		scale = std::max(scale, std::abs(double(a.acceleration[axis][i])));
+	}
+	return scale > 0 ? difference / scale : difference;
+}
+
+/// Runs the same configuration with and without Verlet lists, checking that accelerations differ by at most tolerance (relative)
+template<typename T, int D>
+static void compare(const char* name, std::vector<std::string> arguments, int steps, double tolerance) {
+	std::vector<std::string> verletArguments = arguments;
+	verletArguments.push_back("-verlet-skin");
+	verletArguments.push_back("0.005");
+	double difference = accelerationDifference(grow<T, D>(arguments, steps), grow<T, D>(verletArguments, steps));
+	std::printf("%s: relative acceleration difference %g\n", name, difference);
+	check(difference <= tolerance, name);
+}
+
+int main() {
+	// repulsion radii bounded by the interaction range: lists hold every interacting pair, forces only differ by summation order
+	compare<Surface2, 2>("ring", { "-rep-max-neighbour", "false" }, 40, 1e-4);
+	compare<Surface3, 3>("3D surface", { "-d", "3", "-rep-max-neighbour", "false" }, 40, 1e-4);
+
+	// radii that can grow past the interaction range (long edges, adaptive repulsion, surface tension): Verlet lists are turned off, so runs are identical
+	compare<Tree<2>, 2>("tree, repulsion by max neighbour distance", { "-tree", "-rep-max-neighbour" }, 200, 0);
+	compare<Surface2, 2>("ring, adaptive repulsion", { "-rep-max-neighbour", "false", "-adaptive-repulsion", "0.5" }, 200, 0);
+	compare<Surface2, 2>("ring, surface tension", { "-rep-max-neighbour", "false", "-surface-tension", "1.5" }, 200, 0);
+
+	if (failures > 0) {
+		std::printf("%d check(s) failed.\n", failures);
+		return 1;
+	}
+	std::printf("All checks passed.\n");
+	return 0;
+}
@@ -0,0 +1,71 @@
+#include <cstdio>
+#include <cmath>
+
+#include "../SurfaceFactory.h"
+
+
+/// Checks that the cached volume shared by update() and the outputs never outlives the positions or topology it was computed for, built with `make test`
+/// Exits with 1 if any check fails
+
+static int failures = 0;
+
+/// Exposes the volume queries of a surface model
+template<typename T>
+struct VolumeProbe : T {
+	using T::T;
+	using T::currentVolume;
+	using T::getVolume;
+};
+
+/// Checks the cached volume against a full recomputation, which may only differ by the order of the parallel reduction
+template<typename T>
+static bool matches(VolumeProbe<T>& surface) {
+	double cached = surface.currentVolume(), computed = surface.getVolume();
+	return std::abs(cached - computed) <= 1e-5 * std::max(1.0, std::abs(computed));
+}
+
+/// Grows a surface, filling the cache before each insertion and each step so that a missing invalidation shows up as a stale volume
+template<typename T>
+static void check(const char* name, typename T::Params params, typename T::SpecificParams specificParams, int steps) {
+	VolumeProbe<T> surface(params, specificParams, 0);
+	int stale = 0;
+	for (int t = 0; t < steps; ++t) {
+		real_t progression = real_t(t) / real_t(steps);
+		if (t % 5 == 0) {
+			surface.currentVolume();
+			surface.addParticle(progression);
+			if (!matches(surface)) ++stale;
+		}
+		surface.currentVolume();
+		surface.update(progression);
+		if (!matches(surface)) ++stale;
+	}
+	std::printf("%s: %d stale volume(s) over %d steps\n", name, stale, steps);
+	if (stale > 0) {
+		std::printf("FAILED: %s\n", name);
+		++failures;
+	}
+}
+
+int main() {
+	Surface2::Params ringParams;
+	ringParams.pressure = real_t(.1);
+	check<Surface2>("ring", ringParams, {}, 400);
+
+	Surface3::Params surfaceParams;
+	surfaceParams.pressure = real_t(.1);
+	Surface3::SpecificParams delaunay, edge;
+	edge.strategy = Surface3::GrowthStrategy::ON_EDGE;
+	check<Surface3>("3D surface, Delaunay growth", surfaceParams, delaunay, 200);
+	check<Surface3>("3D surface, edge growth", surfaceParams, edge, 200);
+
+	check<Tree<2>>("2D tree", {}, {}, 400);
+	check<Tree<3>>("3D tree", {}, {}, 200);
+
+	if (failures > 0) {
+		std::printf("%d check(s) failed.\n", failures);
+		return 1;
+	}
+	std::printf("All checks passed.\n");
+	return 0;
+}